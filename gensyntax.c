@@ -0,0 +1,366 @@
+/*** INCLUDES ***/
+
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*** DEFINES ***/
+
+/* turns syntax.def into syntax.h: keyword tables with a perfect hash, the
+ * class of every byte and the escape sequence of every highlight class,
+ * all as static data thor can use as it is */
+
+#define MAX_LANGS 64
+#define MAX_WORDS 1024
+#define MAX_MATCH 32
+#define KEYWORD_MAX_LEN 63
+#define SEED_TRIES 200000
+
+/* these go into syntax.h as SYNTAX_HASH_STEP and SYNTAX_HASH_SLOT too,
+ * so the lookup in thor hashes the same way, one byte at a time */
+#define HASH_STEP_TEXT "(((h) ^ (unsigned char)(c)) * 16777619u)"
+#define HASH_SLOT_TEXT "(((h) ^ ((h) >> 15) ^ (unsigned int)(len)) & (mask))"
+#define HASH_STEP(h, c) (((h) ^ (unsigned char)(c)) * 16777619u)
+#define HASH_SLOT(h, len, mask) (((h) ^ ((h) >> 15) ^ (unsigned int)(len)) & (mask))
+
+/*** DATA ***/
+
+struct keyword {
+    char *word;
+    int len;
+    int type;
+};
+
+struct lang {
+    char *name;
+    char *match[MAX_MATCH];
+    int nmatch;
+    char *comment;
+    char *block_start;
+    char *block_end;
+    int numbers;
+    int strings;
+    struct keyword words[MAX_WORDS];
+    int nwords;
+    int slot[MAX_WORDS];
+    unsigned int size;
+    unsigned int seed;
+};
+
+struct style {
+    int set;
+    int fg;
+    int bg;
+};
+
+const char *CLASSES[] = {
+    "normal", "comment", "mlcomment", "keyword1", "keyword2",
+    "string", "number", "match", NULL
+};
+
+struct lang langs[MAX_LANGS];
+int nlangs;
+struct style styles[16];
+unsigned char separators[256];
+unsigned char quotes[256];
+const char *path;
+int lineno;
+
+/*** HELPERS ***/
+
+void die(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%s:%d: ", path, lineno);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    exit(1);
+}
+
+char *dup(const char *s) {
+    char *d = strdup(s);
+    if(d == NULL) die("out of memory");
+    return d;
+}
+
+void putString(const char *s) {
+    putchar('"');
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') printf("\\%c", *s);
+        else if(isprint((unsigned char)*s)) putchar(*s);
+        else printf("\\%03o", (unsigned char)*s);
+    }
+    putchar('"');
+}
+
+/* C_HL for C, TEXT_FILE_HL for TEXT FILE */
+void putIdent(const char *name, const char *suffix) {
+    for(; *name; name++) putchar(isalnum((unsigned char)*name) ? toupper((unsigned char)*name) : '_');
+    printf("_HL_%s", suffix);
+}
+
+/*** PARSING ***/
+
+struct lang *current() {
+    if(nlangs == 0) die("this needs a language line above it");
+    return &langs[nlangs - 1];
+}
+
+void addWord(char *word, int type) {
+    struct lang *l = current();
+    int len = strlen(word);
+    if(len > KEYWORD_MAX_LEN) die("\"%s\" is longer than %d bytes", word, KEYWORD_MAX_LEN);
+    /* the first one listed wins, just like before */
+    for(int j = 0; j < l->nwords; j++)
+        if(!strcmp(l->words[j].word, word)) return;
+    if(l->nwords == MAX_WORDS) die("too many keywords");
+    l->words[l->nwords].word = dup(word);
+    l->words[l->nwords].len = len;
+    l->words[l->nwords].type = type;
+    l->nwords++;
+}
+
+void parse(FILE *fp) {
+    char line[4096];
+    while(fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *s = line;
+        while(isspace((unsigned char)*s)) s++;
+        if(*s == '\0' || *s == '#') continue;
+        s[strcspn(s, "\r\n")] = '\0';
+
+        char *rest = s + strcspn(s, " \t");
+        if(*rest) *rest++ = '\0';
+        while(*rest == ' ' || *rest == '\t') rest++;
+
+        if(!strcmp(s, "language")) {
+            if(*rest == '\0') die("language needs a name");
+            if(nlangs == MAX_LANGS) die("too many languages");
+            langs[nlangs++].name = dup(rest);
+            continue;
+        }
+
+        char *args[MAX_WORDS];
+        int nargs = 0;
+        for(char *tok = strtok(rest, " \t"); tok; tok = strtok(NULL, " \t")) {
+            if(nargs == MAX_WORDS) die("too many words on one line");
+            args[nargs++] = tok;
+        }
+
+        if(!strcmp(s, "separators") || !strcmp(s, "quotes")) {
+            unsigned char *set = s[0] == 's' ? separators : quotes;
+            for(int j = 0; j < nargs; j++)
+                for(char *c = args[j]; *c; c++) set[(unsigned char)*c] = 1;
+        } else if(!strcmp(s, "color")) {
+            if(nargs < 2 || nargs > 3) die("color needs a class and one or two numbers");
+            int h;
+            for(h = 0; CLASSES[h]; h++)
+                if(!strcmp(CLASSES[h], args[0])) break;
+            if(CLASSES[h] == NULL) die("no highlight class called %s", args[0]);
+            styles[h].set = 1;
+            styles[h].fg = atoi(args[1]);
+            styles[h].bg = nargs == 3 ? atoi(args[2]) : 0;
+            if(styles[h].fg < 0 || styles[h].fg > 255 || styles[h].bg < 0 || styles[h].bg > 255)
+                die("colors go from 0 to 255");
+        } else if(!strcmp(s, "match")) {
+            struct lang *l = current();
+            for(int j = 0; j < nargs; j++) {
+                if(l->nmatch == MAX_MATCH - 1) die("too many matches");
+                l->match[l->nmatch++] = dup(args[j]);
+            }
+        } else if(!strcmp(s, "comment")) {
+            if(nargs != 1) die("comment takes one word");
+            current()->comment = dup(args[0]);
+        } else if(!strcmp(s, "block")) {
+            if(nargs != 2) die("block takes a start and an end");
+            current()->block_start = dup(args[0]);
+            current()->block_end = dup(args[1]);
+        } else if(!strcmp(s, "highlight")) {
+            for(int j = 0; j < nargs; j++) {
+                if(!strcmp(args[j], "numbers")) current()->numbers = 1;
+                else if(!strcmp(args[j], "strings")) current()->strings = 1;
+                else die("can't highlight %s, only numbers and strings", args[j]);
+            }
+        } else if(!strcmp(s, "keywords") || !strcmp(s, "types")) {
+            for(int j = 0; j < nargs; j++) addWord(args[j], s[0] == 'k' ? 1 : 2);
+        } else {
+            die("what is \"%s\"?", s);
+        }
+    }
+}
+
+/*** GENERATING ***/
+
+unsigned int hashWord(const char *s, int len, unsigned int seed) {
+    unsigned int h = seed;
+    for(int j = 0; j < len; j++) h = HASH_STEP(h, s[j]);
+    return HASH_SLOT(h, len, 0xffffffffu);
+}
+
+/* tries seeds until every keyword lands in a slot of its own, growing the
+ * table when a size doesn't work out */
+void perfectHash(struct lang *l) {
+    unsigned int n = 1;
+    while(n < (unsigned int)l->nwords * 2) n <<= 1;
+    unsigned char *used = NULL;
+    for(;; n <<= 1) {
+        used = realloc(used, n);
+        if(used == NULL) die("out of memory");
+        for(unsigned int s = 1; s < SEED_TRIES; s++) {
+            unsigned int sd = s * 2654435761u;
+            memset(used, 0, n);
+            int j;
+            for(j = 0; j < l->nwords; j++) {
+                unsigned int h = hashWord(l->words[j].word, l->words[j].len, sd) & (n - 1);
+                if(used[h]) break;
+                used[h] = 1;
+                l->slot[j] = h;
+            }
+            if(j == l->nwords) {
+                free(used);
+                l->size = n;
+                l->seed = sd;
+                return;
+            }
+        }
+    }
+}
+
+void genClasses() {
+    printf("const unsigned char syntaxClass[256] = {\n");
+    for(int c = 0; c < 256; c++) {
+        int sep = c == '\0' || isspace(c) || separators[c];
+        int digit = isdigit(c);
+        if(!sep && !digit && !quotes[c]) continue;
+        printf("    [%d] = ", c);
+        int any = 0;
+        if(sep) any = printf("CHAR_SEPARATOR");
+        if(digit) any = printf("%sCHAR_DIGIT", any ? " | " : "");
+        if(quotes[c]) printf("%sCHAR_QUOTE", any ? " | " : "");
+        printf(",\n");
+    }
+    printf("};\n\n");
+}
+
+void genStyles() {
+    printf("const struct editorStyle syntaxStyles[] = {\n");
+    for(int h = 0; CLASSES[h]; h++) {
+        if(!styles[h].set) die("no color for %s", CLASSES[h]);
+        char sgr[32];
+        int len = snprintf(sgr, sizeof(sgr), "\x1b[0");
+        if(styles[h].fg) len += snprintf(sgr + len, sizeof(sgr) - len, ";%d", styles[h].fg);
+        if(styles[h].bg) len += snprintf(sgr + len, sizeof(sgr) - len, ";%d", styles[h].bg);
+        len += snprintf(sgr + len, sizeof(sgr) - len, "m");
+        char up[16];
+        int j;
+        for(j = 0; CLASSES[h][j]; j++) up[j] = toupper((unsigned char)CLASSES[h][j]);
+        up[j] = '\0';
+        printf("    [HL_%s] = {%d, %d, ", up, styles[h].fg, styles[h].bg);
+        putString(sgr);
+        printf(", %d},\n", len);
+    }
+    printf("};\n\n");
+}
+
+void genLang(struct lang *l) {
+    printf("char *");
+    putIdent(l->name, "extensions");
+    printf("[] = {");
+    for(int j = 0; j < l->nmatch; j++) {
+        putString(l->match[j]);
+        printf(", ");
+    }
+    printf("NULL};\n");
+
+    int *at = malloc(sizeof(int) * l->size);
+    if(at == NULL) die("out of memory");
+    for(unsigned int j = 0; j < l->size; j++) at[j] = -1;
+    for(int j = 0; j < l->nwords; j++) at[l->slot[j]] = j;
+
+    printf("const struct editorKeyword ");
+    putIdent(l->name, "keywords");
+    printf("[%u] = {\n", l->size);
+    for(unsigned int j = 0; j < l->size; j++) {
+        if(at[j] < 0) continue;
+        struct keyword *k = &l->words[at[j]];
+        printf("    [%u] = {", j);
+        putString(k->word);
+        printf(", %d, HL_KEYWORD%d, %d},\n", k->len, k->type, at[j]);
+    }
+    if(l->nwords == 0) printf("    {NULL, 0, 0, 0}\n");
+    printf("};\n\n");
+    free(at);
+}
+
+void genHldb() {
+    printf("struct editorSyntax HLDB[] = {\n");
+    for(int j = 0; j < nlangs; j++) {
+        struct lang *l = &langs[j];
+
+        unsigned long long lens[256] = {0};
+        for(int k = 0; k < l->nwords; k++)
+            lens[(unsigned char)l->words[k].word[0]] |= 1ULL << l->words[k].len;
+
+        printf("    {\n        ");
+        putString(l->name);
+        printf(",\n        ");
+        putIdent(l->name, "extensions");
+        printf(",\n        {");
+        putIdent(l->name, "keywords");
+        printf(", %uu, %uu, {", l->size - 1, l->seed);
+        int first = 1;
+        for(int c = 0; c < 256; c++) {
+            if(lens[c] == 0) continue;
+            printf("%s[%d] = 0x%llxULL", first ? "" : ", ", c, lens[c]);
+            first = 0;
+        }
+        if(first) printf("0");
+        printf("}},\n        ");
+        const char *parts[3] = {l->comment, l->block_start, l->block_end};
+        for(int k = 0; k < 3; k++) {
+            putString(parts[k] ? parts[k] : "");
+            printf(", ");
+        }
+        for(int k = 0; k < 3; k++)
+            printf("%d,%s", parts[k] ? (int)strlen(parts[k]) : 0, k < 2 ? " " : "\n        ");
+        if(l->numbers && l->strings) printf("HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS");
+        else if(l->numbers) printf("HL_HIGHLIGHT_NUMBERS");
+        else if(l->strings) printf("HL_HIGHLIGHT_STRINGS");
+        else printf("0");
+        printf("\n    },\n");
+    }
+    printf("};\n");
+}
+
+/*** MAIN ***/
+
+int main(int argc, char **argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: gensyntax syntax.def > syntax.h\n");
+        return 1;
+    }
+    path = argv[1];
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) {
+        perror(path);
+        return 1;
+    }
+    parse(fp);
+    fclose(fp);
+    if(nlangs == 0) die("no languages in here");
+    for(int j = 0; j < nlangs; j++) perfectHash(&langs[j]);
+
+    printf("/* generated by gensyntax from %s, edit that instead */\n\n", path);
+    printf("#define SYNTAX_HASH_STEP(h, c) %s\n", HASH_STEP_TEXT);
+    printf("#define SYNTAX_HASH_SLOT(h, len, mask) %s\n\n", HASH_SLOT_TEXT);
+    genClasses();
+    genStyles();
+    for(int j = 0; j < nlangs; j++) genLang(&langs[j]);
+    genHldb();
+    return 0;
+}
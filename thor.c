@@ -9,21 +9,61 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*** DEFINES ***/
 
 #define THOR_VERSION "0.3.0"
 #define THOR_TAB_STOP 8
 #define THOR_QUIT_TIMES 3
+#define THOR_LARGE_FILE (16 * 1024 * 1024)
+#define THOR_INDEX_LINES 1024
+#define THOR_INDEX_THREADS 16
+#define THOR_INPUT_BUF 4096
+#define THOR_ESC_TIMEOUT 100
+#define THOR_PASTE_TIMEOUT 500
+#define THOR_MSG_TIMEOUT 5
+#define THOR_SEARCH_CHUNK (256 * 1024)
+#define THOR_SEARCH_SYNC (4 * 1024 * 1024)
+#define THOR_SEARCH_THREADS 16
+#define THOR_REGEX_STATES 4096
+#define THOR_SAVE_IOV 1024
+#define THOR_SAVE_STEP (8 * 1024 * 1024)
+#define THOR_AUTOSAVE 30
+#define THOR_UNDO_CHUNK (64 * 1024)
+#define THOR_UNDO_MAX (32 * 1024 * 1024)
+#define THOR_UNDO_SPILL 1
+#define THOR_UNDO_PAUSE 2
+#define THOR_HL_MARK 1024
+#define THOR_LONG_LINE (1024 * 1024)
+#define THOR_SPAN_STEP (64 * 1024)
+#define THOR_SLAB_CHUNK (1024 * 1024)
+#define THOR_SLAB_MAX 4096
+#define THOR_ROW_INLINE 5
+#define THOR_BENCH_ROWS 50
+#define THOR_BENCH_COLS 160
+#define THOR_FOLLOW_CHUNK (1024 * 1024)
+#define THOR_DECODE_BLOCK (4 * 1024 * 1024)
 
 #define CTRL_KEY(k) ((k) & 0x1f) 
 
@@ -43,7 +83,9 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_START,
+    PASTE_END
 };
 
 enum editorModes {
@@ -65,34 +107,649 @@ enum editorHighlight {
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+/* what syntaxClass says about a byte */
+#define CHAR_SEPARATOR (1<<0)
+#define CHAR_DIGIT (1<<1)
+#define CHAR_QUOTE (1<<2)
+
 
 /*** DATA ***/
 
+/* the tables below come out of syntax.def through gensyntax, so a
+ * language is all static data by the time thor runs.  keywords sit in a
+ * perfect hash: one slot to look at per candidate length, and lens holds a
+ * bitmask of the keyword lengths that start with each byte */
+
+struct editorKeyword {
+    const char *word;
+    int len;
+    int type;
+    int order;
+};
+
+struct editorKeywordTable {
+    const struct editorKeyword *slots;
+    unsigned int mask;
+    unsigned int seed;
+    unsigned long long lens[256];
+};
+
 struct editorSyntax {
     char *filetype;
     char **filematch;
-    char **keywords;
+    struct editorKeywordTable keywords;
     char *singleline_comment_start;
     char *multiline_comment_start;
     char *multiline_comment_end;
+    int scs_len;
+    int mcs_len;
+    int mce_len;
     int flags;
 };
 
+/* how a highlight class is drawn, with the escape that switches to it */
+struct editorStyle {
+    unsigned char fg;
+    unsigned char bg;
+    const char *sgr;
+    int len;
+};
+
+struct ropeNode;
+
+typedef struct rowText {
+    int refs;
+    int cap;
+    char chars[];
+} rowText;
+
+/* where each tab of a row sits in chars and in render, so columns can
+ * be mapped both ways with a binary search */
+typedef struct tabStop {
+    int cx;
+    int rx;
+} tabStop;
+
+/* the highlighter's state at the top of its loop, dropped every
+ * THOR_HL_MARK render columns of a long row */
+typedef struct hlMark {
+    int i;
+    unsigned char in_string;
+    unsigned char in_comment;
+    unsigned char prev_sep;
+    unsigned char prev_num;
+} hlMark;
+
+/* a row's highlighting as runs of one color, each starting at column rx
+ * and ending where the next one starts; rows short of THOR_LONG_LINE
+ * bytes stay well under 1 << 24 columns even if they are all tabs */
+typedef struct hlRun {
+    unsigned int rx : 24;
+    unsigned int hl : 8;
+} hlRun;
+
+/* only rows with tabs or of THOR_HL_MARK columns and more have stops or
+ * marks, so those hang off the row in a block the others go without */
+typedef struct rowAux {
+    tabStop *tabs;
+    hlMark *marks;
+    int ntabs;
+    int nmarks;
+} rowAux;
+
+/* rows shorter than THOR_ROW_INLINE keep their bytes in inl instead of
+ * a rowText; the fields are ordered so that costs no extra room */
 typedef struct erow {
-    int idx;
-    int size;
-    int rsize;
+    struct ropeNode *leaf;
     char *chars;
+    rowText *text;
     char *render;
     unsigned char *hl;
-    int hl_open_comment;
+    hlRun *runs;
+    rowAux *aux;
+    int size;
+    int rsize;
+    int rcap;
+    int nruns;
+    int hl_gen;
+    int state_gen;
+    int lines;
+    int swapdirty;
+    unsigned char hl_open_comment;
+    unsigned char mapped;
+    unsigned char wide;
+    char inl[THOR_ROW_INLINE];
 } erow;
 
-typedef struct copyrow {
-    int lines;
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 9
+
+typedef struct slabClass {
     int size;
+    void *free;
+    char *next;
+    char *end;
+} slabClass;
+
+struct editorSlab {
+    slabClass bytes[SLAB_CLASSES];
+    slabClass rows;
+};
+
+#define ROPE_LEAF_MAX 64
+#define ROPE_FANOUT 32
+
+typedef struct ropeNode {
+    struct ropeNode *parent;
+    int isleaf;
+    int n;
+    int count;
+    union {
+        erow *rows[ROPE_LEAF_MAX];
+        struct ropeNode *kids[ROPE_FANOUT];
+    } u;
+} ropeNode;
+
+/* out[s] is the comment state at the end of the extent if it starts in
+ * state s */
+typedef struct mapExtent {
+    size_t off;
+    size_t len;
+    int lines;
+    unsigned char out[2];
+} mapExtent;
+
+struct editorIndexer;
+
+typedef struct indexPart {
+    struct editorIndexer *ix;
+    pthread_t thread;
+    size_t start;
+    size_t end;
+    mapExtent *ext;
+    int produced;
+    int consumed;
+    int cap;
+    int done;
+} indexPart;
+
+struct editorIndexer {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int running;
+    int woken;
+    char *map;
+    struct editorSyntax *syntax;
+    int hl_gen;
+    indexPart *parts;
+    int nparts;
+    int cur;
+};
+
+typedef struct editorCodec {
+    char *name;
+    char *ext;
+    unsigned char magic[4];
+    int magiclen;
+    char *decode[3];
+    char *encode[3];
+} editorCodec;
+
+typedef struct decodeExtent {
     char *chars;
-} copyrow;
+    size_t len;
+    int lines;
+    unsigned char in;
+    unsigned char out;
+} decodeExtent;
+
+struct editorDecoder {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int running;
+    int woken;
+    int done;
+    int fd;
+    pid_t pid;
+    int status;
+    editorCodec *codec;
+    struct editorSyntax *syntax;
+    decodeExtent *ext;
+    int produced;
+    int consumed;
+    int cap;
+};
+
+#define CELL_REVERSE (1<<0)
+
+typedef struct screenCell {
+    char ch;
+    unsigned char fg;
+    unsigned char bg;
+    unsigned char attr;
+} screenCell;
+
+struct editorWindow;
+
+/* drawing is clipped to the rectangle at top, left that is width cells
+ * wide, so the rows of a window can be drawn from its own y = 0 */
+struct editorFrame {
+    int rows;
+    int cols;
+    screenCell *cells;
+    screenCell *shadow;
+    int valid;
+    int rowoff;
+    int mode;
+    struct editorWindow *win;
+    int top;
+    int left;
+    int width;
+};
+
+struct searchMatch {
+    int line;
+    int col;
+    int len;
+    const char *p;
+    int left;
+};
+
+/* a compiled DFA runs on byte classes: bytes no part of the pattern tells
+ * apart share a column of next, and state 0 is the dead state */
+typedef struct reDfa {
+    unsigned char cls[256];
+    int nclass;
+    int nstates;
+    int start;
+    int *next;
+    unsigned char *accept;
+} reDfa;
+
+typedef struct searchPattern {
+    char *query;
+    int qlen;
+    int literal;
+    char *must;
+    int mustlen;
+    int bol;
+    int eol;
+    reDfa fwd;
+    reDfa rev;
+} searchPattern;
+
+typedef struct reScratch {
+    int *at;
+    int n;
+    int cap;
+    int *state;
+    int *end;
+    int lcap;
+} reScratch;
+
+#define RESCRATCH_INIT {NULL, 0, 0, NULL, NULL, 0}
+
+struct searchList {
+    struct searchMatch *m;
+    int n;
+    int cap;
+};
+
+typedef struct searchSegment {
+    const char *p;
+    int len;
+    int line;
+    int mapped;
+} searchSegment;
+
+struct searchJob {
+    int first;
+    int last;
+    int done;
+    struct searchList found;
+};
+
+struct searchScan {
+    searchPattern *pat;
+    searchSegment *seg;
+    struct searchJob *jobs;
+    int njobs;
+    int *order;
+    int next;
+    int finished;
+    int matches;
+    int active;
+    int cancelled;
+};
+
+struct searchPool {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t posted;
+    struct searchScan *current;
+    int woken;
+};
+
+struct editorSearch {
+    char *query;
+    struct searchScan *scan;
+    struct searchPool pool;
+    int origin;
+    int job;
+    int idx;
+    int seen;
+    int hl_line;
+    int hl_rx;
+    int hl_len;
+    int gen;
+    int draw;
+    const char *err;
+};
+
+/* mapped is 0 for bytes copied into the job, 1 for offsets into the
+ * mapping and 2 for memory that outlives the save, found at mem */
+typedef struct savePiece {
+    int mapped;
+    size_t off;
+    size_t len;
+    const char *mem;
+} savePiece;
+
+struct saveJob {
+    pthread_t thread;
+    int running;
+    int done;
+    int woken;
+    int err;
+    char *path;
+    char *tmp;
+    int fd;
+    savePiece *pieces;
+    int npieces;
+    int cap;
+    char *bytes;
+    size_t nbytes;
+    size_t bcap;
+    size_t total;
+    size_t written;
+    int dirty;
+    long long started;
+    char *map;
+    int mapfd;
+    editorCodec *codec;
+    int crlf;
+};
+
+typedef struct swapOp {
+    char kind;
+    int at;
+    int n;
+} swapOp;
+
+struct editorSwap {
+    char *path;
+    int fd;
+    erow **rows;
+    int nrows;
+    int rowcap;
+    swapOp *ops;
+    int nops;
+    int opcap;
+    time_t due;
+    int suspended;
+};
+
+enum undoKind {
+    UNDO_INSERT = 1,
+    UNDO_DELETE,
+    UNDO_ROWS_IN,
+    UNDO_ROWS_OUT,
+    UNDO_SUBST
+};
+
+/* a :s rewrites every row it touches as one step, so its record holds one
+ * of these per row, each followed by the old and then the new bytes of the
+ * stretch between the row's first and last match */
+typedef struct undoSubst {
+    int line;
+    int col;
+    int oldlen;
+    int newlen;
+} undoSubst;
+
+typedef struct undoRec {
+    int prev;
+    unsigned char kind;
+    unsigned char group;
+    int line;
+    int col;
+    int len;
+} undoRec;
+
+typedef struct undoChunk {
+    struct undoChunk *prev;
+    struct undoChunk *next;
+    char *data;
+    int used;
+    int cap;
+    int last;
+    off_t spill;
+} undoChunk;
+
+struct editorUndo {
+    undoChunk *first;
+    undoChunk *tail;
+    undoChunk *hc;
+    int hoff;
+    size_t resident;
+    int spillfd;
+    off_t spillend;
+    int pending;
+    int sealed;
+    int suspended;
+    time_t typed;
+};
+
+struct editorInput {
+    char buf[THOR_INPUT_BUF];
+    int len;
+    int pos;
+};
+
+enum benchOp {
+    BENCH_OPEN = 0,
+    BENCH_SYNTAX,
+    BENCH_DRAW,
+    BENCH_FIND,
+    BENCH_SAVE,
+    BENCH_KEY,
+    BENCH_OPS
+};
+
+typedef struct benchStat {
+    long long *ns;
+    int n;
+    int cap;
+} benchStat;
+
+struct editorBench {
+    int on;
+    int *keys;
+    int nkeys;
+    int pos;
+    char *file;
+    char *out;
+    benchStat stat[BENCH_OPS];
+};
+
+/* frame gauges close after every redraw, key gauges at every keypress */
+enum statGaugeId {
+    STAT_FRAME_NS,
+    STAT_BYTES,
+    STAT_APPENDS,
+    STAT_HL_ROWS,
+    STAT_CASCADE,
+    STAT_GAUGES
+};
+
+typedef struct statGauge {
+    long long cur;
+    long long last;
+    long long max;
+    long long total;
+} statGauge;
+
+struct editorStats {
+    int overlay;
+    char *dump;
+    long long frames;
+    long long keys;
+    int chain;
+    statGauge g[STAT_GAUGES];
+};
+
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+#define ABUF_MIN 4096
+
+typedef struct yankPiece {
+    rowText *text;
+    const char *p;
+    int size;
+    int lines;
+} yankPiece;
+
+struct editorYank {
+    yankPiece *pieces;
+    int n;
+    int cap;
+    int lines;
+};
+
+struct editorSpan {
+    char *render;
+    unsigned char *hl;
+    int cap;
+};
+
+/* a followed file is read from off onwards whenever inotify says it
+ * changed; nl tells whether the bytes so far ended their last line */
+struct editorFollow {
+    int on;
+    int fd;
+    int wd;
+    int dwd;
+    off_t off;
+    int nl;
+    int cap;
+    int pending;
+    int moved;
+    long long dropped;
+};
+
+/* everything that belongs to one open file.  the buffer being edited
+ * lives in E itself and the others are parked here, rows, highlighting
+ * and journals included, so switching back costs two struct copies */
+struct editorBuffer {
+    int cx, cy;
+    int rx;
+    int rowoff;
+    int coloff;
+    int wrapoff;
+    int numrows;
+    ropeNode *rope;
+    char *map;
+    size_t mapsize;
+    int mapfd;
+    int mapline;
+    struct editorIndexer *indexer;
+    struct editorDecoder *decoder;
+    editorCodec *codec;
+    int crlf;
+    struct saveJob *save;
+    struct editorSwap swap;
+    struct editorUndo undo;
+    int dirty;
+    char *filename;
+    struct editorSyntax *syntax;
+    int hl_gen;
+    int hl_frontier;
+    int edits;
+    struct editorFollow follow;
+};
+
+struct editorBuffers {
+    struct editorBuffer *list;
+    int n;
+    int cap;
+    int cur;
+};
+
+/* what a window showed when it was last drawn; a window that would show
+ * the same again keeps its cells from the last frame */
+typedef struct windowStamp {
+    int layout;
+    int buf;
+    int edits;
+    int numrows;
+    int hl_gen;
+    int rowoff;
+    int coloff;
+    int wrapoff;
+    int wrap;
+    int hl_line;
+    int hl_rx;
+    int hl_len;
+    int marks;
+} windowStamp;
+
+struct layoutNode;
+
+/* rows is the height of the text, the status line goes right below it */
+typedef struct editorWindow {
+    int buf;
+    int cx, cy;
+    int rx;
+    int rowoff;
+    int coloff;
+    int wrapoff;
+    int top;
+    int left;
+    int rows;
+    int cols;
+    struct layoutNode *node;
+    windowStamp stamp;
+} editorWindow;
+
+/* leaves hold a window, inner nodes split their rectangle in two, side by
+ * side with a separator column between them when vertical */
+typedef struct layoutNode {
+    struct layoutNode *parent;
+    struct layoutNode *kid[2];
+    int vertical;
+    editorWindow *win;
+    int top;
+    int left;
+    int height;
+    int width;
+} layoutNode;
+
+struct editorWindows {
+    layoutNode *root;
+    editorWindow **list;
+    int n;
+    int cap;
+    int cur;
+    int layout;
+};
 
 struct editorConfig {
     int cx, cy;
@@ -103,8 +760,36 @@ struct editorConfig {
     int screenrows;
     int screencols;
     int numrows;
-    erow *row;
-    copyrow *cprow;
+    ropeNode *rope;
+    char *map;
+    size_t mapsize;
+    int mapfd;
+    int mapline;
+    struct editorIndexer *indexer;
+    struct editorDecoder *decoder;
+    editorCodec *codec;
+    int crlf;
+    struct editorFrame frame;
+    struct abuf out;
+    struct editorInput in;
+    struct editorBench bench;
+    struct editorStats stats;
+    struct editorSearch search;
+    struct saveJob *save;
+    struct editorSwap swap;
+    struct editorUndo undo;
+    struct editorBuffers bufs;
+    struct editorWindows wins;
+    int wakefd[2];
+    volatile sig_atomic_t winch;
+    struct editorYank yank;
+    struct editorSpan span;
+    struct editorSlab slab;
+    int autosave;
+    int wrap;
+    int wrapoff;
+    int wrapy;
+    int wrapx;
     int mode;
     int dirty;
     char *filename;
@@ -112,6 +797,11 @@ struct editorConfig {
     char statusmsg[80];
     time_t statusmsg_time;
     struct editorSyntax *syntax;
+    int hl_gen;
+    int hl_frontier;
+    int edits;
+    struct editorFollow follow;
+    int inotify;
     struct termios orig_termios;
 };
 
@@ -119,57 +809,73 @@ struct editorConfig E;
 
 /*** FILETYPES ***/
 
-char *C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
-char *C_HL_keywords[] = {
-    "switch", "if", "while", "for", "break", "continue", "return", "else", 
-    "struct", "union", "typedef", "enum", "class", "case",
-
-    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", 
-    "void|", "#define|", "#include|", "NULL|", NULL
-};
+#include "syntax.h"
 
-char *SHELL_HL_extensions[] = { ".sh", NULL};
-char *SHELL_HL_keywords[] = {
-    "if", "fi", "read", "echo", "for", "while", "do", "done", "elif", "else", NULL
-};
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+#define SYNTAX_STYLES (sizeof(syntaxStyles) / sizeof(syntaxStyles[0]))
 
-char *TXT_HL_extensions[] = { ".txt", NULL };
-char *TXT_HL_keywords[] = { NULL };
-
-
-struct editorSyntax HLDB[] = {
-    {
-        "C",
-        C_HL_extensions,
-        C_HL_keywords,
-        "//", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
-    },
-    {
-        "SHELL",
-        SHELL_HL_extensions,
-        SHELL_HL_keywords,
-        "#", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
-    },
-    {
-        "TEXT FILE",
-        TXT_HL_extensions,
-        TXT_HL_keywords,
-        "", "", "",
-        HL_HIGHLIGHT_NUMBERS 
-    }
+/* compressed files go through the usual command line tools, told apart by
+ * their first bytes when opened and by their name when new */
+editorCodec CODECS[] = {
+    { "gzip", ".gz", {0x1f, 0x8b}, 2, {"gzip", "-dc", NULL}, {"gzip", "-c", NULL} },
+    { "zstd", ".zst", {0x28, 0xb5, 0x2f, 0xfd}, 4, {"zstd", "-dcq", NULL}, {"zstd", "-cq", NULL} }
 };
 
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+#define CODEC_ENTRIES (sizeof(CODECS) / sizeof(CODECS[0]))
 
 /*** PROTOTYPES ***/
 
 void editorSetStatusMessage(const char *fmt, ...);
+int editorIndexerIngest();
+int editorDecodeIngest();
+editorCodec *editorCodecByName(const char *filename);
+int editorSearchPoll();
+int editorSavePoll();
+int editorFollowPoll();
+void editorSwapRow(erow *row);
+void editorSwapForget(erow *row);
+void editorSwapOp(char kind, int at, int n);
+void editorSwapPath();
+void editorSwapFlush();
+void editorSwapReset();
+void editorSwapDrop();
+void editorBufferPark(struct editorBuffer *b);
+void editorBufferLoad(struct editorBuffer *b);
+void editorUndoText(int kind, int line, int col, const char *s, int len);
+void editorUndoRows(int kind, int line, const char *s, int len, int lines);
+void editorOpen(char *filename);
+void editorSaveWait();
+void editorSelectSyntaxHighlight();
+void editorWindowsLayout();
+struct editorWindow *editorWindowCur();
+int editorFollowIngest(struct editorWindow *viewer);
+void editorFollowReopen(off_t off);
+void abAppend(struct abuf *ab, const char *s, int len);
+void abFree(struct abuf *ab);
 void editorRefreshScreen();
+void editorFrameResize(int rows, int cols);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
 void editorMoveCursor(int key);
+void editorCursorTo(int line, int col);
 void editorDelRow(int at);
+void editorDelRows(int at, int n);
+void editorMapShift(int at, int n);
+void editorUpdateRow(erow *row);
+erow *editorRowAt(int at);
+int editorLinesCrlf(const char *p, size_t len);
+void editorSyntaxInvalidateRow(erow *row);
+void editorRowSetText(erow *row, const char *s, int len);
+int editorRowSpan(erow *row, int rx, int len, erow *span);
+long long benchNow();
+long long benchStart();
+void benchRecord(int op, long long start);
+int editorBenchKey();
+long long editorStatsStart();
+void editorStatsChain(int flipped);
+void editorStatsFrame(long long start, int bytes);
+void editorStatsKey();
+int editorStatsLine(char *buf, int size);
+void initEditor();
 
 /*** TERMINAL ***/
 
@@ -182,6 +888,7 @@ void die(const char *s) {
 }
 
 void disableRawMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("tcsetattr");
 }
@@ -198,39 +905,167 @@ void enableRawMode() {
     raw.c_cflag |= (CS8); 
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+int getWindowSize(int *rows, int *cols) { 
+    struct winsize ws;
+
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return -1;
+    } else {
+        *cols = ws.ws_col;
+        *rows = ws.ws_row;
+        return 0;
+    }
+}
+
+/* input is read in as large a batch as the tty hands over and keys are
+ * decoded out of E.in, so a burst of keys costs one read(2) instead of one
+ * per byte and the main loop can tell when the queue has drained */
+
+int editorInputFill(int timeout) {
+    struct editorInput *in = &E.in;
+    if(in->pos == in->len) in->pos = in->len = 0;
+    if(in->len == THOR_INPUT_BUF) return 0;
+
+    if(timeout != 0) {
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if(poll(&pfd, 1, timeout) <= 0) return 0;
+    }
+
+    int nread = read(STDIN_FILENO, &in->buf[in->len], THOR_INPUT_BUF - in->len);
+    /* a resize landing mid read is not an error, the caller just comes back */
+    if(nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+    if(nread <= 0) return 0;
+    in->len += nread;
+    return nread;
+}
+
+int editorInputByte(char *c, int timeout) {
+    struct editorInput *in = &E.in;
+    if(in->pos == in->len && !editorInputFill(timeout)) return 0;
+    *c = in->buf[in->pos++];
+    return 1;
+}
+
+int editorInputPending() {
+    /* a trace is replayed one key per frame, like someone typing */
+    if(E.bench.on) return 0;
+    if(E.in.pos < E.in.len) return 1;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* nothing polls on a timer: the loop sleeps in poll(2) until there is
+ * input, a SIGWINCH or a background thread wrote to the wake pipe, or the
+ * status message is due to expire or the swap file to be written */
+
+void editorHandleWinch(int sig) {
+    (void)sig;
+    E.winch = 1;
+    write(E.wakefd[1], "w", 1);
+}
+
+void editorWake() {
+    write(E.wakefd[1], "i", 1);
+}
+
+int editorNextTimeout() {
+    time_t now = time(NULL);
+    time_t due = 0;
+    /* the message is gone once now reaches its deadline, so that second
+     * must not count as still due or poll would spin through it */
+    if(E.statusmsg[0] != '\0' && E.statusmsg_time + THOR_MSG_TIMEOUT > now)
+        due = E.statusmsg_time + THOR_MSG_TIMEOUT;
+    if(E.swap.due && (due == 0 || E.swap.due < due)) due = E.swap.due;
+    if(due == 0) return -1;
+    return due > now ? (due - now) * 1000 : 0;
+}
+
+void editorUpdateWindowSize() {
+    int rows = THOR_BENCH_ROWS, cols = THOR_BENCH_COLS;
+    if(!E.bench.on && getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+    editorFrameResize(rows, cols);
+    editorWindowsLayout();
+}
+
+void editorWaitForInput() {
+    while(1) {
+        struct pollfd pfd[3] = {
+            {STDIN_FILENO, POLLIN, 0},
+            {E.wakefd[0], POLLIN, 0},
+            {E.inotify, POLLIN, 0}
+        };
+        int n = poll(pfd, 3, editorNextTimeout());
+        if(n == -1) {
+            if(errno != EINTR) die("poll");
+            pfd[0].revents = pfd[1].revents = 0;
+        }
+
+        if(pfd[1].revents & POLLIN) {
+            char drain[64];
+            while(read(E.wakefd[0], drain, sizeof(drain)) > 0);
+        }
+
+        int redraw = (n == 0);
+        if(E.winch) {
+            E.winch = 0;
+            editorUpdateWindowSize();
+            redraw = 1;
+        }
+        if(editorIndexerIngest()) redraw = 1;
+        if(editorDecodeIngest()) redraw = 1;
+        if(editorSearchPoll()) redraw = 1;
+        if(editorSavePoll()) redraw = 1;
+        if(editorFollowPoll()) redraw = 1;
+        if(E.swap.due && time(NULL) >= E.swap.due) editorSwapFlush();
+        if(redraw) editorRefreshScreen();
+
+        if(pfd[0].revents) return;
+    }
 }
 
 int editorReadKey() {
-    int nread;
+    editorStatsKey();
+    if(E.bench.on) return editorBenchKey();
+
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if(nread == -1 && errno != EAGAIN) die("read");
+    while (!editorInputByte(&c, 0)) {
+        editorWaitForInput();
     }
 
     
     if(c == '\x1b') {
         char seq[3];
 
-        if(read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if(read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if(!editorInputByte(&seq[0], THOR_ESC_TIMEOUT)) return '\x1b';
+        if(!editorInputByte(&seq[1], THOR_ESC_TIMEOUT)) return '\x1b';
 
                   
         if(seq[0] == '[') {
             if(seq[1] >= '0' && seq[1] <= '9') {
-                if(read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                int n = seq[1] - '0';
+                while(1) {
+                    if(!editorInputByte(&seq[2], THOR_ESC_TIMEOUT)) return '\x1b';
+                    if(seq[2] < '0' || seq[2] > '9') break;
+                    n = n * 10 + seq[2] - '0';
+                }
                 if(seq[2] == '~') {
-                    switch(seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                    switch(n) {
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200: return PASTE_START;
+                        case 201: return PASTE_END;
                     }
                 }
             } else {
@@ -258,584 +1093,5388 @@ int editorReadKey() {
 
 }
 
-int getWindowSize(int *rows, int *cols) { 
-    struct winsize ws;
+/* with bracketed paste the terminal wraps pasted text in ESC[200~ and
+ * ESC[201~; everything in between is collected raw so it can be applied
+ * in one go instead of key by key.  pasted line breaks arrive as \r.  a
+ * terminal that goes quiet for THOR_PASTE_TIMEOUT without closing the
+ * paste gets what it sent so far pasted and normal input back */
+char *editorReadPaste(int *len) {
+    int cap = 256;
+    int n = 0;
+    char *buf = malloc(cap);
+    if(buf == NULL) die("malloc");
+
+    long long quiet = 0;
+    while(1) {
+        char c;
+        if(!editorInputByte(&c, THOR_PASTE_TIMEOUT)) {
+            /* a resize cuts a wait short, so quiet counts from the first */
+            long long now = benchNow();
+            if(quiet == 0) quiet = now;
+            else if(now - quiet >= THOR_PASTE_TIMEOUT * 1000000LL) break;
+            continue;
+        }
+        quiet = 0;
+        if(n == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if(buf == NULL) die("realloc");
+        }
+        buf[n++] = c;
+        if(n >= 6 && !memcmp(&buf[n - 6], "\x1b[201~", 6)) {
+            n -= 6;
+            break;
+        }
+    }
 
-    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-        return -1;
-    } else {
-        *cols = ws.ws_col;
-        *rows = ws.ws_row;
-        return 0;
+    int j, k;
+    for(j = 0, k = 0; j < n; j++) {
+        if(buf[j] == '\r') {
+            buf[k++] = '\n';
+            if(j + 1 < n && buf[j + 1] == '\n') j++;
+        } else {
+            buf[k++] = buf[j];
+        }
     }
+    *len = k;
+    return buf;
 }
 
-/*** SYNTAX HIGHLIGHTING ***/
+/*** ROW MEMORY ***/
 
-int is_separator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+/* row text, render and hl blocks and the erows themselves come out of
+ * slabs.  a class hands out blocks of one size, carved from chunks of
+ * THOR_SLAB_CHUNK and recycled through a free list threaded through the
+ * freed blocks.  byte blocks come in powers of two from 16 bytes up to
+ * THOR_SLAB_MAX and anything bigger goes to malloc, so callers keep the
+ * capacity they were given and hand it back when they free */
+
+void editorSlabInit() {
+    for(int c = 0; c < SLAB_CLASSES; c++)
+        E.slab.bytes[c].size = 1 << (SLAB_MIN_SHIFT + c);
+    E.slab.rows.size = sizeof(erow);
 }
 
-void editorUpdateSyntax(erow *row) {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+void *slabAlloc(slabClass *c) {
+    void *p = c->free;
+    if(p) {
+        c->free = *(void **)p;
+        return p;
+    }
+    if(c->end - c->next < c->size) {
+        int chunk = THOR_SLAB_CHUNK / c->size * c->size;
+        c->next = malloc(chunk);
+        if(c->next == NULL) die("malloc");
+        c->end = c->next + chunk;
+    }
+    p = c->next;
+    c->next += c->size;
+    return p;
+}
 
-    if(E.syntax == NULL) return;
+void slabFree(slabClass *c, void *p) {
+    *(void **)p = c->free;
+    c->free = p;
+}
 
-    char **keywords = E.syntax->keywords;
+/* what a request for want bytes actually gets */
+int slabBytesCap(int want) {
+    if(want > THOR_SLAB_MAX) return want;
+    int cap = 1 << SLAB_MIN_SHIFT;
+    while(cap < want) cap <<= 1;
+    return cap;
+}
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+slabClass *slabBytesClass(int cap) {
+    if(cap > THOR_SLAB_MAX) return NULL;
+    int c = 0;
+    while((1 << (SLAB_MIN_SHIFT + c)) < cap) c++;
+    return &E.slab.bytes[c];
+}
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+void *slabBytes(int cap) {
+    slabClass *c = slabBytesClass(cap);
+    void *p = c ? slabAlloc(c) : malloc(cap);
+    if(p == NULL) die("malloc");
+    return p;
+}
 
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+void slabBytesFree(void *p, int cap) {
+    if(p == NULL) return;
+    slabClass *c = slabBytesClass(cap);
+    if(c) slabFree(c, p);
+    else free(p);
+}
 
-    int i = 0;
-    while(i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl [i-1] : HL_NORMAL;
+erow *editorRowNew() {
+    erow *row = slabAlloc(&E.slab.rows);
+    memset(row, 0, sizeof(erow));
+    return row;
+}
 
-        if(scs_len && !in_string && !in_comment) {
-            if(!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+void editorRowDispose(erow *row) {
+    slabFree(&E.slab.rows, row);
+}
 
-        if(mcs_len && mce_len && !in_string) {
-            if(in_comment) {
-                row->hl[i] = HL_MLCOMMENT;
-                if(!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if(!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
-        }
+rowText *rowTextNew(const char *s, int len, int want) {
+    int cap = slabBytesCap(sizeof(rowText) + want);
+    rowText *t = slabBytes(cap);
+    t->refs = 1;
+    t->cap = cap - sizeof(rowText);
+    memcpy(t->chars, s, len);
+    t->chars[len] = '\0';
+    return t;
+}
 
-        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if(in_string) {
-                row->hl[i] = HL_STRING;
-                if(c == '\\' &&  i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING;
-                    i+= 2;
-                    continue;
-                }
-                if(c == in_string) in_string = 0;
-                i++;
-                prev_sep = 1;
-                continue;
-            } else {
-                if(c == '"' || c == '\'' || c == '`') {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
-        }
+void rowTextRelease(rowText *t) {
+    if(--t->refs == 0) slabBytesFree(t, sizeof(rowText) + t->cap);
+}
 
+int editorRowNtabs(erow *row) {
+    return row->aux ? row->aux->ntabs : 0;
+}
 
-        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || 
-                    (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
+int editorRowNmarks(erow *row) {
+    return row->aux ? row->aux->nmarks : 0;
+}
+
+rowAux *editorRowAux(erow *row) {
+    if(row->aux == NULL) {
+        row->aux = calloc(1, sizeof(rowAux));
+        if(row->aux == NULL) die("calloc");
+    }
+    return row->aux;
+}
+
+/* room for n > 0 tab stops, keeping the ones already there */
+tabStop *editorRowTabsReserve(erow *row, int n) {
+    rowAux *x = editorRowAux(row);
+    x->tabs = realloc(x->tabs, sizeof(tabStop) * n);
+    if(x->tabs == NULL) die("realloc");
+    return x->tabs;
+}
+
+void editorRowAuxTrim(erow *row) {
+    if(row->aux->tabs == NULL && row->aux->marks == NULL) {
+        free(row->aux);
+        row->aux = NULL;
+    }
+}
+
+/* takes over m, and gives the aux block back once it holds nothing */
+void editorRowSetMarks(erow *row, hlMark *m, int n) {
+    if(n == 0) {
+        free(m);
+        m = NULL;
+    }
+    if(m == NULL && row->aux == NULL) return;
+    rowAux *x = editorRowAux(row);
+    free(x->marks);
+    x->marks = m;
+    x->nmarks = n;
+    editorRowAuxTrim(row);
+}
+
+void editorRowDropAux(erow *row) {
+    if(row->aux == NULL) return;
+    free(row->aux->tabs);
+    free(row->aux->marks);
+    free(row->aux);
+    row->aux = NULL;
+}
+
+/* a row with no tabs to expand renders as its own chars, so render just
+ * points at them and the row's block, if any, holds only hl */
+int editorRowPlain(erow *row) {
+    return !row->wide && editorRowNtabs(row) == 0;
+}
+
+/* render and hl share one block: render in the first rcap bytes and,
+ * once the row has been highlighted, hl in the next rcap */
+void editorRowRenderBlock(erow *row, int rcap, int withhl) {
+    int plain = editorRowPlain(row);
+    int bytes = (plain ? 0 : rcap) + (withhl ? rcap : 0);
+    char *block = bytes ? slabBytes(bytes) : NULL;
+    unsigned char *hl = withhl ? (unsigned char *)block + bytes - rcap : NULL;
+    if(!plain && row->render) memcpy(block, row->render, row->rsize + 1);
+    if(hl && row->hl) memcpy(hl, row->hl, row->rsize);
+    slabBytesFree(plain ? (void *)row->hl : row->render,
+            (plain ? 0 : row->rcap) + (row->hl ? row->rcap : 0));
+    row->render = plain ? row->chars : block;
+    row->hl = hl;
+    row->rcap = block ? rcap : 0;
+}
+
+hlRun editorPlainRun = {0, HL_NORMAL};
+
+void editorRowDropRuns(erow *row) {
+    if(row->runs != &editorPlainRun)
+        slabBytesFree(row->runs, slabBytesCap(sizeof(hlRun) * row->nruns));
+    row->runs = NULL;
+    row->nruns = 0;
+}
+
+void editorRowDropRender(erow *row) {
+    if(row->render || row->hl) {
+        int plain = editorRowPlain(row);
+        slabBytesFree(plain ? (void *)row->hl : row->render,
+                (plain ? 0 : row->rcap) + (row->hl ? row->rcap : 0));
+    }
+    editorRowDropRuns(row);
+    row->render = NULL;
+    row->hl = NULL;
+    row->rcap = 0;
+}
+
+void editorSpanReserve(int need) {
+    struct editorSpan *sp = &E.span;
+    if(sp->cap >= need) return;
+    sp->cap = need;
+    sp->render = realloc(sp->render, need);
+    sp->hl = realloc(sp->hl, need);
+    if(sp->render == NULL || sp->hl == NULL) die("realloc");
+}
+
+/* freshly lexed highlighting is kept as runs when they take less room
+ * than a byte per column, which for plain text or whole comment lines
+ * is one run, shared by all of them; hl == NULL means all normal */
+void editorRowStoreHl(erow *row, unsigned char *hl) {
+    int n = 0;
+    for(int i = 0; hl && i < row->rsize; i++)
+        if(i == 0 || hl[i] != hl[i - 1]) n++;
+
+    editorRowDropRuns(row);
+    if(n > (int)(row->rsize / sizeof(hlRun))) {
+        if(row->hl == NULL)
+            editorRowRenderBlock(row, row->rcap ? row->rcap :
+                    slabBytesCap(row->rsize + 1), 1);
+        memcpy(row->hl, hl, row->rsize);
+        return;
+    }
+
+    if(row->hl) editorRowRenderBlock(row, row->rcap, 0);
+    if(n == 0 || (n == 1 && hl[0] == HL_NORMAL)) {
+        row->runs = &editorPlainRun;
+        row->nruns = 1;
+        return;
+    }
+    row->runs = slabBytes(slabBytesCap(sizeof(hlRun) * n));
+    row->nruns = n;
+    n = 0;
+    for(int i = 0; i < row->rsize; i++) {
+        if(i && hl[i] == hl[i - 1]) continue;
+        row->runs[n].rx = i;
+        row->runs[n++].hl = hl[i];
+    }
+}
+
+/* columns [rx, rx + len) of a row kept as runs, one byte each */
+void editorRowRunsFill(erow *row, int rx, int len, unsigned char *out) {
+    int lo = 0, hi = row->nruns;
+    while(lo < hi) {
+        int m = (lo + hi) / 2;
+        if(row->runs[m].rx <= rx) lo = m + 1;
+        else hi = m;
+    }
+    int k = lo - 1;
+    int end = rx + len;
+    while(rx < end) {
+        int next = k + 1 < row->nruns ? row->runs[k + 1].rx : end;
+        if(next > end) next = end;
+        memset(out, row->runs[k].hl, next - rx);
+        out += next - rx;
+        rx = next;
+        k++;
+    }
+}
+
+/* an edit patches hl in place, so a row about to be edited gets its runs
+ * spread back out to a byte per column */
+void editorRowUnpackHl(erow *row) {
+    if(row->runs == NULL) return;
+    editorRowRenderBlock(row, row->rcap ? row->rcap :
+            slabBytesCap(row->rsize + 1), 1);
+    if(row->rsize) editorRowRunsFill(row, 0, row->rsize, row->hl);
+    editorRowDropRuns(row);
+}
+
+/*** ROW STORAGE ***/
+
+/* rows live in a rope of line blocks: leaves hold up to ROPE_LEAF_MAX rows,
+ * inner nodes up to ROPE_FANOUT children and every node knows how many rows
+ * are below it, so a lookup, insert or delete only walks one path from the
+ * root and a row finds its own line number by walking back up.
+ *
+ * a leaf entry can also be a mapped extent: a run of untouched lines that
+ * still point into the mmapped file.  extents are turned into real rows one
+ * line at a time, the first time something asks for that line. */
+
+ropeNode *ropeNewNode(int isleaf) {
+    ropeNode *node = calloc(1, sizeof(ropeNode));
+    if(node == NULL) die("calloc");
+    node->isleaf = isleaf;
+    return node;
+}
+
+int ropeSlotOf(ropeNode *parent, ropeNode *child) {
+    int j;
+    for(j = 0; j < parent->n; j++)
+        if(parent->u.kids[j] == child) break;
+    return j;
+}
+
+int ropeRowSlot(erow *row) {
+    ropeNode *leaf = row->leaf;
+    int j;
+    for(j = 0; j < leaf->n; j++)
+        if(leaf->u.rows[j] == row) break;
+    return j;
+}
+
+void ropeAdjust(ropeNode *node, int delta) {
+    for(; node; node = node->parent) node->count += delta;
+}
+
+ropeNode *ropeLeafFor(int at, int *slot, int *off) {
+    ropeNode *node = E.rope;
+    while(!node->isleaf) {
+        int j;
+        for(j = 0; j < node->n - 1 && at >= node->u.kids[j]->count; j++)
+            at -= node->u.kids[j]->count;
+        node = node->u.kids[j];
+    }
+    int j = 0;
+    while(j < node->n && at >= node->u.rows[j]->lines)
+        at -= node->u.rows[j++]->lines;
+    *slot = j;
+    *off = at;
+    return node;
+}
+
+ropeNode *ropeSplit(ropeNode *node) {
+    ropeNode *parent = node->parent;
+    if(parent == NULL) {
+        parent = ropeNewNode(0);
+        parent->u.kids[0] = node;
+        parent->n = 1;
+        parent->count = node->count;
+        node->parent = parent;
+        E.rope = parent;
+    } else if(parent->n == ROPE_FANOUT) {
+        ropeSplit(parent);
+        parent = node->parent;
+    }
+
+    ropeNode *right = ropeNewNode(node->isleaf);
+    int half = node->n / 2;
+    int moved = 0;
+    right->n = node->n - half;
+    right->parent = parent;
+    if(node->isleaf) {
+        memcpy(right->u.rows, &node->u.rows[half], sizeof(erow *) * right->n);
+        for(int j = 0; j < right->n; j++) {
+            right->u.rows[j]->leaf = right;
+            moved += right->u.rows[j]->lines;
+        }
+    } else {
+        memcpy(right->u.kids, &node->u.kids[half], sizeof(ropeNode *) * right->n);
+        for(int j = 0; j < right->n; j++) {
+            right->u.kids[j]->parent = right;
+            moved += right->u.kids[j]->count;
+        }
+    }
+    node->n = half;
+    node->count -= moved;
+    right->count = moved;
+
+    int pos = ropeSlotOf(parent, node) + 1;
+    memmove(&parent->u.kids[pos + 1], &parent->u.kids[pos],
+            sizeof(ropeNode *) * (parent->n - pos));
+    parent->u.kids[pos] = right;
+    parent->n++;
+    return right;
+}
+
+void ropeRemoveChild(ropeNode *parent, ropeNode *child) {
+    int pos = ropeSlotOf(parent, child);
+    memmove(&parent->u.kids[pos], &parent->u.kids[pos + 1],
+            sizeof(ropeNode *) * (parent->n - pos - 1));
+    parent->n--;
+    free(child);
+}
+
+void ropeMergeLeaves(ropeNode *a, ropeNode *b) {
+    memcpy(&a->u.rows[a->n], b->u.rows, sizeof(erow *) * b->n);
+    for(int j = 0; j < b->n; j++) b->u.rows[j]->leaf = a;
+    a->n += b->n;
+    a->count += b->count;
+    ropeRemoveChild(a->parent, b);
+}
+
+void ropeCompact(ropeNode *node) {
+    while(node->parent) {
+        ropeNode *parent = node->parent;
+        if(node->n == 0) {
+            ropeRemoveChild(parent, node);
+        } else if(node->isleaf && node->n < ROPE_LEAF_MAX / 4) {
+            int pos = ropeSlotOf(parent, node);
+            ropeNode *prev = pos > 0 ? parent->u.kids[pos - 1] : NULL;
+            ropeNode *next = pos + 1 < parent->n ? parent->u.kids[pos + 1] : NULL;
+            if(next && node->n + next->n <= ROPE_LEAF_MAX)
+                ropeMergeLeaves(node, next);
+            else if(prev && prev->n + node->n <= ROPE_LEAF_MAX)
+                ropeMergeLeaves(prev, node);
+            else
+                break;
+        } else {
+            break;
+        }
+        node = parent;
+    }
+
+    while(!E.rope->isleaf && E.rope->n == 1) {
+        ropeNode *root = E.rope;
+        E.rope = root->u.kids[0];
+        E.rope->parent = NULL;
+        free(root);
+    }
+    if(!E.rope->isleaf && E.rope->n == 0) E.rope->isleaf = 1;
+}
+
+erow *ropeEntryNext(erow *row) {
+    ropeNode *node = row->leaf;
+    int slot = ropeRowSlot(row);
+    if(slot + 1 < node->n) return node->u.rows[slot + 1];
+
+    while(node->parent) {
+        ropeNode *parent = node->parent;
+        int pos = ropeSlotOf(parent, node);
+        if(pos + 1 < parent->n) {
+            node = parent->u.kids[pos + 1];
+            while(!node->isleaf) node = node->u.kids[0];
+            return node->u.rows[0];
+        }
+        node = parent;
+    }
+    return NULL;
+}
+
+erow *ropeEntryPrev(erow *row) {
+    ropeNode *node = row->leaf;
+    int slot = ropeRowSlot(row);
+    if(slot > 0) return node->u.rows[slot - 1];
+
+    while(node->parent) {
+        ropeNode *parent = node->parent;
+        int pos = ropeSlotOf(parent, node);
+        if(pos > 0) {
+            node = parent->u.kids[pos - 1];
+            while(!node->isleaf) node = node->u.kids[node->n - 1];
+            return node->u.rows[node->n - 1];
+        }
+        node = parent;
+    }
+    return NULL;
+}
+
+void ropeInsertEntry(ropeNode *leaf, int slot, erow *row) {
+    if(leaf->n == ROPE_LEAF_MAX) {
+        ropeNode *right = ropeSplit(leaf);
+        if(slot > leaf->n) {
+            slot -= leaf->n;
+            leaf = right;
+        }
+    }
+    memmove(&leaf->u.rows[slot + 1], &leaf->u.rows[slot],
+            sizeof(erow *) * (leaf->n - slot));
+    leaf->u.rows[slot] = row;
+    leaf->n++;
+    row->leaf = leaf;
+    ropeAdjust(leaf, row->lines);
+}
+
+erow *ropeSplitExtent(erow *ext, int off) {
+    char *p = ext->chars;
+    char *end = ext->chars + ext->size;
+    for(int j = 0; j < off; j++) p = (char *)memchr(p, '\n', end - p) + 1;
+
+    erow *tail = editorRowNew();
+    tail->mapped = 1;
+    tail->chars = p;
+    tail->size = end - p;
+    tail->lines = ext->lines - off;
+
+    ext->size = p - ext->chars;
+    ext->lines = off;
+    ropeAdjust(ext->leaf, -tail->lines);
+    ropeInsertEntry(ext->leaf, ropeRowSlot(ext) + 1, tail);
+    if(ext->swapdirty) editorSwapRow(tail);
+    editorSyntaxInvalidateRow(ext);
+    return tail;
+}
+
+erow *ropeMaterialize(erow *ext, int off) {
+    if(off > 0) ext = ropeSplitExtent(ext, off);
+    if(ext->lines > 1) ropeSplitExtent(ext, 1);
+
+    char *line = ext->chars;
+    int len = ext->size;
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+
+    editorRowSetText(ext, line, len);
+    ext->mapped = 0;
+    editorUpdateRow(ext);
+    return ext;
+}
+
+void ropeInsert(int at, erow *row) {
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(at, &slot, &off);
+    if(off) {
+        erow *ext = leaf->u.rows[slot];
+        ropeSplitExtent(ext, off);
+        leaf = ext->leaf;
+        slot = ropeRowSlot(ext) + 1;
+    }
+    ropeInsertEntry(leaf, slot, row);
+}
+
+/* detaches the entries holding lines [at, at + n) and hands them back in
+ * order.  extents are split at either end rather than materialized, and
+ * each leaf gives up its share with one memmove and one count update */
+erow **ropeRemoveRange(int at, int n, int *count) {
+    int slot, off;
+    ropeNode *leaf;
+    if(at + n < E.rope->count) {
+        leaf = ropeLeafFor(at + n, &slot, &off);
+        if(off) ropeSplitExtent(leaf->u.rows[slot], off);
+    }
+    leaf = ropeLeafFor(at, &slot, &off);
+    if(off) ropeSplitExtent(leaf->u.rows[slot], off);
+
+    erow **gone = NULL;
+    int ngone = 0, cap = 0;
+    int left = n;
+    while(left > 0) {
+        leaf = ropeLeafFor(at, &slot, &off);
+        int j = slot, lines = 0;
+        while(j < leaf->n && lines + leaf->u.rows[j]->lines <= left)
+            lines += leaf->u.rows[j++]->lines;
+
+        if(ngone + j - slot > cap) {
+            while(ngone + j - slot > cap) cap = cap ? cap * 2 : 64;
+            gone = realloc(gone, sizeof(erow *) * cap);
+            if(gone == NULL) die("realloc");
+        }
+        for(int k = slot; k < j; k++) {
+            erow *row = leaf->u.rows[k];
+            row->leaf = NULL;
+            gone[ngone++] = row;
+        }
+
+        memmove(&leaf->u.rows[slot], &leaf->u.rows[j], sizeof(erow *) * (leaf->n - j));
+        leaf->n -= j - slot;
+        ropeAdjust(leaf, -lines);
+        ropeCompact(leaf);
+        left -= lines;
+    }
+
+    *count = ngone;
+    return gone;
+}
+
+erow *editorRowAt(int at) {
+    if(at < 0 || at >= E.rope->count) return NULL;
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(at, &slot, &off);
+    erow *row = leaf->u.rows[slot];
+    return row->mapped ? ropeMaterialize(row, off) : row;
+}
+
+int editorRowIndex(erow *row) {
+    ropeNode *node = row->leaf;
+    int idx = 0;
+    for(int j = 0; node->u.rows[j] != row; j++)
+        idx += node->u.rows[j]->lines;
+    while(node->parent) {
+        ropeNode *parent = node->parent;
+        for(int j = 0; parent->u.kids[j] != node; j++)
+            idx += parent->u.kids[j]->count;
+        node = parent;
+    }
+    return idx;
+}
+
+erow *editorRowNext(erow *row) {
+    erow *next = ropeEntryNext(row);
+    return (next && next->mapped) ? ropeMaterialize(next, 0) : next;
+}
+
+erow *editorRowPrev(erow *row) {
+    erow *prev = ropeEntryPrev(row);
+    return (prev && prev->mapped) ? ropeMaterialize(prev, prev->lines - 1) : prev;
+}
+
+/*** SYNTAX HIGHLIGHTING ***/
+
+int is_separator(int c) {
+    return syntaxClass[(unsigned char)c] & CHAR_SEPARATOR;
+}
+
+#define KEYWORD_MAX_LEN 63
+
+/* the hash runs along the text once, so trying each candidate length only
+ * costs the bytes it adds */
+int editorMatchKeyword(const char *s, int len, int *klen) {
+    const struct editorKeywordTable *kt = &E.syntax->keywords;
+    unsigned long long m = kt->lens[(unsigned char)s[0]];
+    unsigned int h = kt->seed;
+    int hashed = 0;
+    int best = -1;
+    int type = 0;
+    while(m) {
+        int l = __builtin_ctzll(m);
+        m &= m - 1;
+        if(l > len) break;
+        for(; hashed < l; hashed++) h = SYNTAX_HASH_STEP(h, s[hashed]);
+        if(!is_separator(s[l])) continue;
+
+        const struct editorKeyword *k = &kt->slots[SYNTAX_HASH_SLOT(h, l, kt->mask)];
+        if(k->len == l && !memcmp(k->word, s, l) &&
+                (best == -1 || k->order < best)) {
+            best = k->order;
+            type = k->type;
+            *klen = l;
+        }
+    }
+    return type;
+}
+
+/* the highlighter can start from any mark instead of column 0.  while it
+ * walks it drops fresh marks, and given the old marks of the row (moved
+ * to where they now land) it stops at the first one it hits in exactly
+ * the same state, since everything from there on would come out the same;
+ * that old mark's index is returned.  it returns -2 at the first step at
+ * or past `stop`, with the state there left in st, and -1 at the end.
+ *
+ * columns are those of the whole row; `row` may be a span of it starting
+ * at column `base` (see editorRowSpan).  a mark's in_comment is 2 past
+ * the start of a line comment, which still gets marks like any other
+ * stretch so a wide row can be picked up anywhere in it */
+
+struct markList {
+    hlMark *m;
+    int n;
+    int cap;
+};
+
+int editorSyntaxReach() {
+    return KEYWORD_MAX_LEN + 1 + E.syntax->scs_len + E.syntax->mcs_len + E.syntax->mce_len;
+}
+
+hlMark editorSyntaxStart(erow *row) {
+    hlMark st = {0, 0, 0, 1, 0};
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+    erow *prev = ropeEntryPrev(row);
+    st.in_comment = (mcs && mce && mcs[0] && mce[0] && prev &&
+            prev->hl_open_comment);
+    return st;
+}
+
+int editorSyntaxLex(erow *row, int base, hlMark *st, int stop,
+        struct markList *out, hlMark *old, int nold) {
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+
+    int scs_len = E.syntax->scs_len;
+    int mcs_len = E.syntax->mcs_len;
+    int mce_len = E.syntax->mce_len;
+
+    int prev_sep = st->prev_sep;
+    int in_string = st->in_string;
+    int in_comment = st->in_comment;
+
+    int next = st->i + THOR_HL_MARK;
+    int oc = 0;
+    int found = -1;
+
+    int first = st->i - base;
+    int i = first;
+    while(i < row->rsize) {
+        char c = row->render[i];
+        unsigned char prev_hl = (i > first) ? row->hl [i-1] :
+            (st->prev_num ? HL_NUMBER : HL_NORMAL);
+        int at = base + i;
+
+        while(oc < nold && old[oc].i < at) oc++;
+        if(oc < nold && old[oc].i == at && old[oc].in_string == in_string &&
+                old[oc].in_comment == in_comment &&
+                old[oc].prev_sep == prev_sep &&
+                old[oc].prev_num == (prev_hl == HL_NUMBER)) {
+            found = oc;
+            break;
+        }
+        if(at >= stop || (out && at >= next)) {
+            hlMark m = {at, in_string, in_comment, prev_sep, prev_hl == HL_NUMBER};
+            if(at >= stop) {
+                *st = m;
+                return -2;
+            }
+            if(out->n == out->cap) {
+                out->cap = out->cap ? out->cap * 2 : 16;
+                out->m = realloc(out->m, sizeof(hlMark) * out->cap);
+                if(out->m == NULL) die("realloc");
+            }
+            out->m[out->n++] = m;
+            next = at + THOR_HL_MARK;
+        }
+
+        if(in_comment == 2) {
+            /* up to the next mark to drop, the stop or an old mark */
+            int to = row->rsize;
+            if(out && next - base < to) to = next - base;
+            if(stop - base < to) to = stop - base;
+            int k = oc;
+            while(k < nold && old[k].i <= at) k++;
+            if(k < nold && old[k].i - base < to) to = old[k].i - base;
+            memset(&row->hl[i], HL_COMMENT, to - i);
+            i = to;
+            continue;
+        }
+
+        if(scs_len && !in_string && !in_comment) {
+            if(!strncmp(&row->render[i], scs, scs_len)) {
+                in_comment = 2;
+                continue;
+            }
+        }
+
+        if(mcs_len && mce_len && !in_string) {
+            if(in_comment) {
+                row->hl[i] = HL_MLCOMMENT;
+                if(!strncmp(&row->render[i], mce, mce_len)) {
+                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                } else {
+                    i++;
+                    continue;
+                }
+            } else if(!strncmp(&row->render[i], mcs, mcs_len)) {
+                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if(in_string) {
+                row->hl[i] = HL_STRING;
+                if(c == '\\' &&  i + 1 < row->rsize) {
+                    row->hl[i + 1] = HL_STRING;
+                    i+= 2;
+                    continue;
+                }
+                if(c == in_string) in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            } else {
+                if(syntaxClass[(unsigned char)c] & CHAR_QUOTE) {
+                    in_string = c;
+                    row->hl[i] = HL_STRING;
+                    i++;
+                    continue;
+                }
+            }
+        }
+
+
+        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if(((syntaxClass[(unsigned char)c] & CHAR_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) || 
+                    (c == '.' && prev_hl == HL_NUMBER)) {
+                row->hl[i] = HL_NUMBER;
+                i++;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if(prev_sep) {
+            int klen;
+            int type = editorMatchKeyword(&row->render[i], row->rsize - i, &klen);
+            if(type) {
+                memset(&row->hl[i], type, klen);
+                i += klen;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        row->hl[i] = HL_NORMAL;
+        prev_sep = is_separator(c);
+        i++;
+    }
+
+    if(found == -1) row->hl_open_comment = in_comment == 1;
+    return found;
+}
+
+/* a wide row has no render or hl of its own, so it is lexed one span at
+ * a time; each span runs far enough past its cut that nothing before the
+ * cut is missing lookahead, and the next starts from the state there */
+int editorSyntaxStream(erow *row, hlMark *st, struct markList *out,
+        hlMark *old, int nold) {
+    int reach = editorSyntaxReach();
+    int skipped = 0;
+    while(1) {
+        int stop = st->i + THOR_SPAN_STEP;
+        if(stop >= row->rsize) stop = INT_MAX;
+        while(skipped < nold && old[skipped].i < st->i) skipped++;
+        erow span;
+        int base = editorRowSpan(row, st->i, THOR_SPAN_STEP + reach, &span);
+        int found = editorSyntaxLex(&span, base, st, stop, out,
+                old + skipped, nold - skipped);
+        if(found == -1) row->hl_open_comment = span.hl_open_comment;
+        if(found != -2) return found < 0 ? found : skipped + found;
+    }
+}
+
+void editorUpdateSyntax(erow *row) {
+    row->hl_gen = row->state_gen = E.hl_gen;
+    E.stats.g[STAT_HL_ROWS].cur++;
+    editorRowSetMarks(row, NULL, 0);
+
+    if(E.syntax == NULL) {
+        if(!row->wide) editorRowStoreHl(row, NULL);
+        row->hl_open_comment = 0;
+        return;
+    }
+
+    struct markList out = {NULL, 0, 0};
+    hlMark st = editorSyntaxStart(row);
+    if(row->wide) {
+        editorSyntaxStream(row, &st, &out, NULL, 0);
+    } else {
+        /* lexed into the span, then kept as runs or bytes */
+        erow lex;
+        memset(&lex, 0, sizeof(lex));
+        editorSpanReserve(row->rsize + 1);
+        lex.render = row->render;
+        lex.hl = E.span.hl;
+        lex.rsize = row->rsize;
+        editorSyntaxLex(&lex, 0, &st, INT_MAX, &out, NULL, 0);
+        row->hl_open_comment = lex.hl_open_comment;
+        editorRowStoreHl(row, lex.hl);
+    }
+    editorRowSetMarks(row, out.m, out.n);
+}
+
+/* an edit left the row's render spliced together from three parts: the
+ * untouched head up to rx0, fresh columns up to mid (and again for the
+ * width of the tab at nrx), and slid along old text, whose highlighting
+ * was moved with it.  lexing restarts from the last mark the edit cannot
+ * reach and runs only until it falls back into step with the old marks */
+void editorSyntaxPatch(erow *row, int rx0, int mid, int orx, int ow,
+        int nrx, int nw) {
+    int d1 = nrx - orx;
+    int d2 = d1 + nw - ow;
+
+    if(E.syntax == NULL) {
+        if(row->hl == NULL) return;
+        memset(&row->hl[rx0], HL_NORMAL, mid - rx0);
+        if(nw) memset(&row->hl[nrx], HL_NORMAL, nw);
+        return;
+    }
+
+    int reach = editorSyntaxReach();
+    E.stats.g[STAT_HL_ROWS].cur++;
+
+    /* marks the lexer may resume from, and old marks it may rejoin: past
+     * the edit, and past the tab too if that tab changed width */
+    int n = editorRowNmarks(row);
+    hlMark *old = n ? row->aux->marks : NULL;
+    int keep = 0;
+    while(keep < n && old[keep].i + reach <= rx0) keep++;
+    int from = (ow == nw) ? mid - d1 : orx + ow;
+    int rejoin = keep;
+    while(rejoin < n && old[rejoin].i < from) rejoin++;
+    for(int j = rejoin; j < n; j++)
+        old[j].i += old[j].i < orx ? d1 : d2;
+
+    hlMark st = keep ? old[keep - 1] : editorSyntaxStart(row);
+    int open = row->hl_open_comment;
+    struct markList out = {NULL, 0, 0};
+    int found = row->wide ?
+        editorSyntaxStream(row, &st, &out, old + rejoin, n - rejoin) :
+        editorSyntaxLex(row, 0, &st, INT_MAX, &out, old + rejoin, n - rejoin);
+    hlMark *fresh = out.m;
+    int nfresh = out.n;
+
+    int tail = found == -1 ? 0 : n - rejoin - found;
+    hlMark *marks = malloc(sizeof(hlMark) * (keep + nfresh + tail + 1));
+    if(marks == NULL) die("malloc");
+    if(keep) memcpy(marks, old, sizeof(hlMark) * keep);
+    if(nfresh) memcpy(&marks[keep], fresh, sizeof(hlMark) * nfresh);
+    if(tail) memcpy(&marks[keep + nfresh], &old[rejoin + found],
+            sizeof(hlMark) * tail);
+    free(fresh);
+    editorRowSetMarks(row, marks, keep + nfresh + tail);
+
+    if(row->hl_open_comment != open) {
+        erow *next = ropeEntryNext(row);
+        if(next) editorSyntaxInvalidateRow(next);
+        editorStatsChain(1);
+    }
+}
+
+/* only the multiline comment state carries over from one line to the next,
+ * so rows that are not on screen (and mapped extents, straight from the
+ * file bytes) are scanned for that state alone */
+
+int editorSyntaxScan(struct editorSyntax *syn, const char *s, int len,
+        int in_comment) {
+    char *scs = syn->singleline_comment_start;
+    char *mcs = syn->multiline_comment_start;
+    char *mce = syn->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int in_string = 0;
+    int i = 0;
+    while(i < len) {
+        char c = s[i];
+
+        if(scs_len && !in_string && !in_comment) {
+            if(i + scs_len <= len && !memcmp(&s[i], scs, scs_len)) break;
+        }
+
+        if(!in_string) {
+            if(in_comment) {
+                if(i + mce_len <= len && !memcmp(&s[i], mce, mce_len)) {
+                    i += mce_len;
+                    in_comment = 0;
+                } else {
+                    i++;
+                }
+                continue;
+            } else if(i + mcs_len <= len && !memcmp(&s[i], mcs, mcs_len)) {
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if(syn->flags & HL_HIGHLIGHT_STRINGS) {
+            if(in_string) {
+                if(c == '\\' && i + 1 < len) {
+                    i += 2;
+                    continue;
+                }
+                if(c == in_string) in_string = 0;
+            } else if(c == '"' || c == '\'' || c == '`') {
+                in_string = c;
+            }
+        }
+        i++;
+    }
+    return in_comment;
+}
+
+int editorSyntaxScanExtent(erow *ext, int in_comment) {
+    char *p = ext->chars;
+    char *end = ext->chars + ext->size;
+    while(p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        if(nl == NULL) nl = end;
+        in_comment = editorSyntaxScan(E.syntax, p, nl - p, in_comment);
+        p = nl + 1;
+    }
+    return in_comment;
+}
+
+void editorSyntaxInvalidateRow(erow *row) {
+    row->hl_gen = row->state_gen = 0;
+    int at = editorRowIndex(row);
+    if(at < E.hl_frontier) E.hl_frontier = at;
+}
+
+void editorSyntaxInvalidate(int at) {
+    if(at < 0 || at >= E.rope->count) return;
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(at, &slot, &off);
+    erow *row = leaf->u.rows[slot];
+    row->hl_gen = row->state_gen = 0;
+    if(at - off < E.hl_frontier) E.hl_frontier = at - off;
+}
+
+/* every row before E.hl_frontier has a trusted hl_open_comment.  walking
+ * forward re-scans only rows whose state is stale, and a changed result
+ * only invalidates the row after it, so the pass stops spreading as soon
+ * as the state converges */
+
+void editorSyntaxSync(int upto) {
+    if(E.hl_frontier >= upto) return;
+
+    char *mcs = E.syntax ? E.syntax->multiline_comment_start : NULL;
+    char *mce = E.syntax ? E.syntax->multiline_comment_end : NULL;
+    if(!mcs || !mce || !mcs[0] || !mce[0]) {
+        E.hl_frontier = INT_MAX;
+        return;
+    }
+    if(E.hl_frontier >= E.rope->count) return;
+
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(E.hl_frontier, &slot, &off);
+    erow *e = leaf->u.rows[slot];
+    erow *prev = ropeEntryPrev(e);
+    int line = E.hl_frontier - off;
+    int in_comment = prev ? prev->hl_open_comment : 0;
+
+    while(e && line < upto) {
+        if(e->state_gen != E.hl_gen) {
+            int out = e->mapped ? editorSyntaxScanExtent(e, in_comment) :
+                editorSyntaxScan(E.syntax, e->chars, e->size, in_comment);
+            if(out != e->hl_open_comment) {
+                erow *next = ropeEntryNext(e);
+                if(next) next->hl_gen = next->state_gen = 0;
+                editorStatsChain(1);
+            } else {
+                editorStatsChain(0);
+            }
+            e->hl_open_comment = out;
+            e->state_gen = E.hl_gen;
+        }
+        in_comment = e->hl_open_comment;
+        line += e->lines;
+        e = ropeEntryNext(e);
+    }
+    E.hl_frontier = line;
+}
+
+void editorHighlightRow(erow *row, int at) {
+    editorSyntaxSync(at + 1);
+    if(row->hl_gen != E.hl_gen) {
+        long long t = benchStart();
+        editorUpdateSyntax(row);
+        benchRecord(BENCH_SYNTAX, t);
+    }
+}
+
+
+void editorSelectSyntaxHighlight() {
+    E.syntax = NULL;
+    E.hl_gen++;
+    E.hl_frontier = 0;
+    if(E.filename == NULL) return;
+
+    char *ext = strrchr(E.filename, '.');
+    size_t extlen = ext ? strlen(ext) : 0;
+    /* notes.c.gz highlights like notes.c */
+    if(ext && editorCodecByName(E.filename)) {
+        char *end = ext;
+        ext = NULL;
+        for(char *p = end - 1; p >= E.filename && *p != '/'; p--) {
+            if(*p == '.') {
+                ext = p;
+                break;
+            }
+        }
+        extlen = ext ? (size_t)(end - ext) : 0;
+    }
+
+    for(unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = &HLDB[j];
+        unsigned int i = 0;
+        while(s->filematch[i]) {
+            int is_ext = (s->filematch[i][0] == '.');
+            if((is_ext && ext && strlen(s->filematch[i]) == extlen &&
+                        !strncmp(ext, s->filematch[i], extlen)) ||
+                    (!is_ext && strstr(E.filename, s->filematch[i]))) {
+                E.syntax = s;
+                return;
+            }
+            i++;
+        }
+    }
+}
+
+/*** ROW OPERATIONS ***/
+
+/* first tab at or after column cx */
+int editorRowTabAt(erow *row, int cx) {
+    int lo = 0, hi = editorRowNtabs(row);
+    while(lo < hi) {
+        int m = (lo + hi) / 2;
+        if(row->aux->tabs[m].cx < cx) lo = m + 1;
+        else hi = m;
+    }
+    return lo;
+}
+
+int editorRowCxToRx(erow *row, int cx) {
+    int k = editorRowTabAt(row, cx);
+    if(k == 0) return cx;
+    tabStop *t = &row->aux->tabs[k - 1];
+    return t->rx + THOR_TAB_STOP - t->rx % THOR_TAB_STOP + (cx - t->cx - 1);
+}
+
+int editorRowRxToCx(erow *row, int rx) {
+    int lo = 0, hi = editorRowNtabs(row);
+    while(lo < hi) {
+        int m = (lo + hi) / 2;
+        if(row->aux->tabs[m].rx <= rx) lo = m + 1;
+        else hi = m;
+    }
+
+    int cx = rx;
+    if(lo > 0) {
+        tabStop *t = &row->aux->tabs[lo - 1];
+        int end = t->rx + THOR_TAB_STOP - t->rx % THOR_TAB_STOP;
+        if(rx < end) return t->cx;
+        cx = t->cx + 1 + (rx - end);
+    }
+    return cx < row->size ? cx : row->size;
+}
+
+void editorRenderRow(erow *row) {
+    int tabs = 0;
+    int j;
+    for(j = 0; j < row->size; j++)
+        if(row->chars[j] == '\t') tabs++;
+
+    editorRowDropRender(row);
+    row->wide = row->size >= THOR_LONG_LINE;
+    editorRowDropAux(row);
+    tabStop *ts = tabs ? editorRowTabsReserve(row, tabs) : NULL;
+    if(tabs) row->aux->ntabs = tabs;
+    if(!row->wide)
+        editorRowRenderBlock(row, slabBytesCap(row->size + tabs*(THOR_TAB_STOP - 1) + 1), 0);
+
+    int idx = 0;
+    tabs = 0;
+    for(j = 0; j < row->size; j++) {
+        if(row->chars[j] == '\t') {
+            ts[tabs].cx = j;
+            ts[tabs++].rx = idx;
+            if(row->wide) {
+                idx += THOR_TAB_STOP - idx % THOR_TAB_STOP;
+                continue;
+            }
+            row->render[idx++] = ' ';
+            while(idx % 8 != 0) row->render[idx++] = ' ';
+        } else if(row->wide || !ts) {
+            idx++;
+        } else {
+            row->render[idx++] = row->chars[j];
+        }
+    }
+    if(!row->wide && ts) row->render[idx] = '\0';
+    row->rsize = idx;
+}
+
+/* rows of THOR_LONG_LINE bytes or more are wide: they keep their tab
+ * stops and highlight marks but no render or hl, and whatever needs to
+ * look at some of their columns gets them built into one shared span.
+ * the span starts on the character holding column rx and is filled in
+ * as a stand-in row, whose columns are counted from the returned base */
+int editorRowSpan(erow *row, int rx, int len, erow *span) {
+    int cx = editorRowRxToCx(row, rx);
+    int base = editorRowCxToRx(row, cx);
+    int end = rx + len < row->rsize ? rx + len : row->rsize;
+    int need = end - base + THOR_TAB_STOP + 1;
+
+    struct editorSpan *sp = &E.span;
+    editorSpanReserve(need);
+
+    int idx = base;
+    int n = 0;
+    for(; cx < row->size && idx < end; cx++) {
+        if(row->chars[cx] == '\t') {
+            do sp->render[n++] = ' '; while(++idx % THOR_TAB_STOP != 0);
+        } else {
+            sp->render[n++] = row->chars[cx];
+            idx++;
+        }
+    }
+    sp->render[n] = '\0';
+
+    memset(span, 0, sizeof(*span));
+    span->render = sp->render;
+    span->hl = sp->hl;
+    span->rsize = n;
+    return base;
+}
+
+/* the render and hl of columns [rx, rx + len) of a highlighted row: runs
+ * are spread out into the span, and for a wide row both are lexed into it
+ * starting from the last mark at or before rx */
+int editorRowView(erow *row, int rx, int len, char **render, unsigned char **hl) {
+    if(rx >= row->rsize) return 0;
+    if(len > row->rsize - rx) len = row->rsize - rx;
+    if(!row->wide) {
+        *render = &row->render[rx];
+        if(row->hl) {
+            *hl = &row->hl[rx];
+        } else {
+            editorSpanReserve(len);
+            editorRowRunsFill(row, rx, len, E.span.hl);
+            *hl = E.span.hl;
+        }
+        return len;
+    }
+
+    hlMark st = {0, 0, 0, 1, 0};
+    if(E.syntax) {
+        int lo = 0, hi = editorRowNmarks(row);
+        while(lo < hi) {
+            int m = (lo + hi) / 2;
+            if(row->aux->marks[m].i <= rx) lo = m + 1;
+            else hi = m;
+        }
+        st = lo ? row->aux->marks[lo - 1] : editorSyntaxStart(row);
+    } else {
+        st.i = rx;
+    }
+
+    erow span;
+    int reach = E.syntax ? editorSyntaxReach() : 0;
+    int base = editorRowSpan(row, st.i, rx + len - st.i + reach, &span);
+    if(E.syntax) editorSyntaxLex(&span, base, &st, rx + len, NULL, NULL, 0);
+    else memset(span.hl, HL_NORMAL, span.rsize);
+    *render = &span.render[rx - base];
+    *hl = &span.hl[rx - base];
+    return len;
+}
+
+void editorUpdateRow(erow *row) {
+    editorRenderRow(row);
+    editorSyntaxInvalidateRow(row);
+}
+
+/* brings render, the tab stops and the highlighting up to date after dlen
+ * bytes at `at` were replaced by ilen new ones.  only the new bytes and
+ * the first tab after them are rendered again: the text up to that tab
+ * slides by d1, and past it every column is back on a tab stop so the
+ * rest slides by d2, which is how a one key edit stays clear of the far
+ * end of a long line */
+void editorRowPatch(erow *row, int at, int dlen, int ilen) {
+    if(row->wide ? row->size < THOR_LONG_LINE / 2 : row->size >= THOR_LONG_LINE) {
+        editorUpdateRow(row);
+        return;
+    }
+
+    int k = editorRowTabAt(row, at);
+    int k2 = editorRowTabAt(row, at + dlen);
+    int rx0 = editorRowCxToRx(row, at);
+    int oend = editorRowCxToRx(row, at + dlen);
+    int ntabs = editorRowNtabs(row);
+    tabStop *ts = ntabs ? row->aux->tabs : NULL;
+
+    int ntab = 0;
+    int mid = rx0;
+    int j;
+    for(j = at; j < at + ilen; j++) {
+        if(row->chars[j] == '\t') {
+            ntab++;
+            mid += THOR_TAB_STOP - mid % THOR_TAB_STOP;
+        } else {
+            mid++;
+        }
+    }
+
+    /* a row gaining its first tab or losing its last one changes how its
+     * render is kept, so it is built again */
+    int nt = k + ntab + (ntabs - k2);
+    if(!row->wide && (ntabs == 0) != (nt == 0)) {
+        editorUpdateRow(row);
+        return;
+    }
+    int plain = editorRowPlain(row);
+    if(row->runs && E.syntax && row->hl_gen == E.hl_gen) editorRowUnpackHl(row);
+
+    int d1 = mid - oend;
+    int orx = row->rsize, ow = 0, nw = 0;
+    if(k2 < ntabs) {
+        orx = ts[k2].rx;
+        ow = THOR_TAB_STOP - orx % THOR_TAB_STOP;
+        nw = THOR_TAB_STOP - (orx + d1) % THOR_TAB_STOP;
+    }
+    int d2 = d1 + nw - ow;
+    int nsize = row->rsize + d2;
+
+    if(!row->wide && (!plain || row->hl) && row->rcap < nsize + 1)
+        editorRowRenderBlock(row, slabBytesCap(nsize + 1 + nsize / 4), row->hl != NULL);
+
+    /* slide the two old stretches, the far one first when growing.  a tab
+     * that keeps its width moves with the rest, so then it is one stretch */
+    int whole = ow == nw;
+    int pass;
+    for(pass = 0; pass < 2 && !row->wide; pass++) {
+        int far = (d1 > 0) == (pass == 0);
+        if(far && whole) continue;
+        int src = far ? orx + ow : oend;
+        int len = far ? row->rsize - orx - ow : (whole ? row->rsize : orx) - oend;
+        int d = far ? d2 : d1;
+        if(len <= 0 || d == 0) continue;
+        if(!plain) memmove(&row->render[src + d], &row->render[src], len);
+        if(row->hl) memmove(&row->hl[src + d], &row->hl[src], len);
+    }
+
+    int idx = rx0;
+    for(j = at; j < at + ilen && !row->wide && !plain; j++) {
+        if(row->chars[j] == '\t') {
+            row->render[idx++] = ' ';
+            while(idx % THOR_TAB_STOP != 0) row->render[idx++] = ' ';
+        } else {
+            row->render[idx++] = row->chars[j];
+        }
+    }
+    if(!row->wide && !plain) {
+        if(nw) memset(&row->render[orx + d1], ' ', nw);
+        row->render[nsize] = '\0';
+    }
+    row->rsize = nsize;
+
+    if(nt > ntabs) ts = editorRowTabsReserve(row, nt);
+    if(k2 < ntabs)
+        memmove(&ts[k + ntab], &ts[k2],
+                sizeof(tabStop) * (ntabs - k2));
+    for(j = k + ntab; j < nt; j++) {
+        ts[j].rx += j == k + ntab ? d1 : d2;
+        ts[j].cx += ilen - dlen;
+    }
+    idx = rx0;
+    for(j = at; j < at + ilen; j++) {
+        if(row->chars[j] == '\t') {
+            ts[k].cx = j;
+            ts[k++].rx = idx;
+            idx += THOR_TAB_STOP - idx % THOR_TAB_STOP;
+        } else {
+            idx++;
+        }
+    }
+    if(nt == 0 && ntabs) {
+        free(ts);
+        row->aux->tabs = NULL;
+        editorRowAuxTrim(row);
+    }
+    if(row->aux) row->aux->ntabs = nt;
+
+    if((row->hl || row->runs || row->wide) && row->hl_gen == E.hl_gen)
+        editorSyntaxPatch(row, rx0, mid, orx, ow, orx + d1, nw);
+    else
+        editorSyntaxInvalidateRow(row);
+}
+
+/* row text lives in a refcounted block so the yank buffer and pasted
+ * rows can share it; whatever is about to change a row takes a private
+ * copy first if anyone else still holds it */
+
+void editorRowSetText(erow *row, const char *s, int len) {
+    if(len < THOR_ROW_INLINE) {
+        memcpy(row->inl, s, len);
+        row->inl[len] = '\0';
+        row->text = NULL;
+        row->chars = row->inl;
+    } else {
+        row->text = rowTextNew(s, len, len + 1);
+        row->chars = row->text->chars;
+    }
+    row->size = len;
+}
+
+void editorRowReserve(erow *row, int size) {
+    rowText *t = row->text;
+    if(t == NULL) {
+        if(size < THOR_ROW_INLINE) return;
+        row->text = rowTextNew(row->chars, row->size, size + 1);
+    } else if(t->refs > 1) {
+        t->refs--;
+        row->text = rowTextNew(row->chars, row->size, size + 1);
+    } else if(t->cap < size + 1) {
+        row->text = rowTextNew(row->chars, row->size, size + 1 + size / 4);
+        rowTextRelease(t);
+    }
+    row->chars = row->text->chars;
+    if(editorRowPlain(row) && row->render) row->render = row->chars;
+}
+
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > E.numrows) return;
+
+    erow *row = editorRowNew();
+    editorRowSetText(row, s, len);
+    row->lines = 1;
+    ropeInsert(at, row);
+    editorMapShift(at, 1);
+    editorUpdateRow(row);
+    editorSyntaxInvalidate(at + 1);
+    editorSwapOp('i', at, 1);
+    editorSwapRow(row);
+    editorUndoRows(UNDO_ROWS_IN, at, s, len, 1);
+
+    E.numrows++;
+    E.dirty++;
+    E.edits++;
+}
+
+/* a yank holds references, not copies: materialized rows lend their text
+ * block and untouched stretches of the mapping are kept as pointers into
+ * it, so yanking and pasting cost one entry per row or extent */
+
+void editorYankFree() {
+    struct editorYank *Y = &E.yank;
+    for(int i = 0; i < Y->n; i++)
+        if(Y->pieces[i].text) rowTextRelease(Y->pieces[i].text);
+    free(Y->pieces);
+    Y->pieces = NULL;
+    Y->n = Y->cap = Y->lines = 0;
+}
+
+void editorYankAdd(rowText *text, const char *p, int size, int lines) {
+    struct editorYank *Y = &E.yank;
+    if(Y->n == Y->cap) {
+        Y->cap = Y->cap ? Y->cap * 2 : 64;
+        Y->pieces = realloc(Y->pieces, sizeof(yankPiece) * Y->cap);
+        if(Y->pieces == NULL) die("realloc");
+    }
+    Y->pieces[Y->n].text = text;
+    Y->pieces[Y->n].p = p;
+    Y->pieces[Y->n].size = size;
+    Y->pieces[Y->n].lines = lines;
+    Y->n++;
+    Y->lines += lines;
+}
+
+void editorYankRow(int at, int lines) {
+    editorYankFree();
+
+    if(lines > E.numrows - at) lines = E.numrows - at;
+    if(lines <= 0) return;
+
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(at, &slot, &off);
+    erow *e = leaf->u.rows[slot];
+    int left = lines;
+    for(; e && left > 0; e = ropeEntryNext(e)) {
+        if(!e->mapped) {
+            rowText *t = e->text;
+            if(t) t->refs++;
+            else t = rowTextNew(e->chars, e->size, e->size + 1);
+            editorYankAdd(t, t->chars, e->size, 1);
+            left--;
+            continue;
+        }
+
+        const char *p = e->chars;
+        const char *end = e->chars + e->size;
+        for(int j = 0; j < off; j++) p = (char *)memchr(p, '\n', end - p) + 1;
+        int take = e->lines - off < left ? e->lines - off : left;
+        const char *q = p;
+        for(int j = 0; j < take && q < end; j++) {
+            const char *nl = memchr(q, '\n', end - q);
+            q = nl ? nl + 1 : end;
+        }
+        editorYankAdd(NULL, p, q - p, take);
+        left -= take;
+        off = 0;
+    }
+
+    if (lines == 1)
+        editorSetStatusMessage("Yanked that %d line!", lines);
+    else if (lines == 69) 
+        editorSetStatusMessage("Yanked those nice %d lines!", lines);
+    else 
+        editorSetStatusMessage("Yanked those %d lines!", lines);
+}
+
+void editorDelYankRow(int at, int lines) {
+    editorYankRow(at, lines);
+    editorDelRows(at, lines);
+
+    if (lines == 1)
+        editorSetStatusMessage("Voided from space-time %d line!", lines);
+    else if (lines == 69) 
+        editorSetStatusMessage("Voided from space-time %d lines, not nice!", lines);
+    else 
+        editorSetStatusMessage("Voided from space-time %d lines!", lines);
+}
+
+/* splices the whole yank in after one descent of the rope: every entry
+ * goes right after the previous one, rows get their render built and the
+ * block is invalidated for highlighting once */
+void editorInsertYank(int at) {
+    struct editorYank *Y = &E.yank;
+    if(at < 0 || at > E.numrows || Y->n == 0) return;
+
+    erow *prev = NULL;
+    int line = at;
+    for(int i = 0; i < Y->n; i++) {
+        yankPiece *y = &Y->pieces[i];
+        erow *row = editorRowNew();
+        row->chars = (char *)y->p;
+        row->size = y->size;
+        row->lines = y->lines;
+        if(y->text) {
+            row->text = y->text;
+            y->text->refs++;
+            editorRenderRow(row);
+        } else {
+            row->mapped = 1;
+        }
+
+        if(prev) ropeInsertEntry(prev->leaf, ropeRowSlot(prev) + 1, row);
+        else ropeInsert(at, row);
+        prev = row;
+
+        editorSwapOp('i', line, y->lines);
+        editorSwapRow(row);
+        editorUndoRows(UNDO_ROWS_IN, line, y->p, y->size, y->lines);
+        line += y->lines;
+    }
+
+    editorMapShift(at, Y->lines);
+    editorSyntaxInvalidate(at);
+    editorSyntaxInvalidate(line);
+    E.numrows += Y->lines;
+    E.dirty++;
+    E.edits++;
+}
+
+void editorPasteRows() {
+    if(E.yank.n == 0) editorSetStatusMessage("Nothing in Yank Buffer");
+    else {
+        int lines = E.yank.lines;
+        int at = E.cy + 1 > E.numrows ? E.numrows : E.cy + 1;
+        editorInsertYank(at);
+
+        editorCursorTo(at + lines - 1, E.cx);
+
+        if (lines == 1)
+            editorSetStatusMessage("Pasted with magic %d line!", lines);
+        else if (lines == 69) 
+            editorSetStatusMessage("Pasted with nice magic %d lines!", lines);
+        else 
+            editorSetStatusMessage("Pasted with magic %d lines!", lines);
+    }
+}
+
+/* extents still coming from the indexer or the decoder go in at
+ * E.mapline, right after the last line of the file read so far.  rows put
+ * in or taken out above it move it along; rows added at it stay below
+ * the rest of the file, as if it had all been there already */
+void editorMapShift(int at, int n) {
+    if(n > 0 && at < E.mapline) E.mapline += n;
+    else if(n < 0 && at < E.mapline) E.mapline = at - n <= E.mapline ? E.mapline + n : at;
+}
+
+void editorFreeRow(erow *row) {
+    if(row->swapdirty) editorSwapForget(row);
+    editorRowDropRender(row);
+    if(row->text) rowTextRelease(row->text);
+    editorRowDropAux(row);
+}
+
+/* removes n rows at once; the row that ends up at `at` is the only one
+ * whose highlighting can change */
+void editorDelRows(int at, int n) {
+    if(at < 0 || at >= E.numrows) return;
+    if(n > E.numrows - at) n = E.numrows - at;
+    if(n <= 0) return;
+
+    int count;
+    erow **gone = ropeRemoveRange(at, n, &count);
+    for(int j = 0; j < count; j++) {
+        erow *row = gone[j];
+        editorUndoRows(UNDO_ROWS_OUT, at, row->chars, row->size, row->lines);
+        editorFreeRow(row);
+        editorRowDispose(row);
+    }
+    free(gone);
+
+    editorMapShift(at, -n);
+    editorSyntaxInvalidate(at);
+    editorSwapOp('d', at, n);
+    E.numrows -= n;
+    E.dirty++;
+    E.edits++;
+}
+
+void editorDelRow(int at) {
+    editorDelRows(at, 1);
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+    if(at < 0 || at > row->size) at = row->size;
+    char ch = c;
+    editorUndoText(UNDO_INSERT, editorRowIndex(row), at, &ch, 1);
+    editorRowReserve(row, row->size + 1);
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    editorRowPatch(row, at, 0, 1);
+    editorSwapRow(row);
+    E.dirty++;
+    E.edits++;
+}
+
+void editorRowInsertString(erow *row, int at, char *s, size_t len) {
+    if(at < 0 || at > row->size) at = row->size;
+    editorUndoText(UNDO_INSERT, editorRowIndex(row), at, s, len);
+    editorRowReserve(row, row->size + len);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    editorRowPatch(row, at, 0, len);
+    editorSwapRow(row);
+    E.dirty++;
+    E.edits++;
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len) {
+    editorUndoText(UNDO_INSERT, editorRowIndex(row), row->size, s, len);
+    editorRowReserve(row, row->size + len);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorRowPatch(row, row->size - len, 0, len);
+    editorSwapRow(row);
+    E.dirty++;
+    E.edits++;
+}
+
+void editorRowDelRange(erow *row, int at, int len) {
+    if(at < 0 || at >= row->size || len <= 0) return;
+    if(len > row->size - at) len = row->size - at;
+    editorUndoText(UNDO_DELETE, editorRowIndex(row), at, &row->chars[at], len);
+    editorRowReserve(row, row->size);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    editorRowPatch(row, at, len, 0);
+    editorSwapRow(row);
+    E.dirty++;
+    E.edits++;
+}
+
+/* puts ilen bytes of s in place of the dlen at `at` with a single patch
+ * of the row.  it is not journaled, whoever calls it records the change */
+void editorRowReplace(erow *row, int at, int dlen, const char *s, int ilen) {
+    int size = row->size - dlen + ilen;
+    editorRowReserve(row, size > row->size ? size : row->size);
+    memmove(&row->chars[at + ilen], &row->chars[at + dlen], row->size - at - dlen + 1);
+    memcpy(&row->chars[at], s, ilen);
+    row->size = size;
+    editorRowPatch(row, at, dlen, ilen);
+    editorSwapRow(row);
+    E.dirty++;
+    E.edits++;
+}
+
+void editorRowDelChar(erow *row, int at) {
+    editorRowDelRange(row, at, 1);
+}
+
+/*** EDITOR OPERATIONS ***/
+
+void editorInsertChar(int c) {
+    if(E.cy == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+    }
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+    E.cx++;
+}
+
+void editorInsertNewline() {
+    if(E.cx == 0) {
+        editorInsertRow(E.cy, "", 0);
+    } else {
+        erow *row = editorRowAt(E.cy);
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+        editorRowDelRange(row, E.cx, row->size - E.cx);
+    }
+    E.cy++;
+    E.cx = 0;
+}
+
+/* inserts a whole block of text at the cursor: the current row is split
+ * once and every pasted line becomes one new row */
+void editorInsertText(char *s, int len) {
+    if(len == 0) return;
+    if(E.cy == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+    }
+    erow *row = editorRowAt(E.cy);
+
+    char *nl = memchr(s, '\n', len);
+    if(nl == NULL) {
+        editorRowInsertString(row, E.cx, s, len);
+        E.cx += len;
+        return;
+    }
+
+    int taillen = row->size - E.cx;
+    char *end = s + len;
+    char *last = nl;
+    char *p;
+    while((p = memchr(last + 1, '\n', end - last - 1)) != NULL) last = p;
+    last++;
+
+    int lastlen = end - last;
+    char *buf = malloc(lastlen + taillen);
+    if(buf == NULL) die("malloc");
+    memcpy(buf, last, lastlen);
+    memcpy(&buf[lastlen], &row->chars[E.cx], taillen);
+
+    editorRowDelRange(row, E.cx, taillen);
+    editorRowAppendString(row, s, nl - s);
+
+    int at = E.cy + 1;
+    p = nl + 1;
+    while(p < last) {
+        char *q = memchr(p, '\n', last - p);
+        editorInsertRow(at++, p, q - p);
+        p = q + 1;
+    }
+    editorInsertRow(at, buf, lastlen + taillen);
+    free(buf);
+
+    E.cy = at;
+    E.cx = lastlen;
+}
+
+void editorPaste() {
+    int len;
+    char *text = editorReadPaste(&len);
+    editorInsertText(text, len);
+    free(text);
+}
+
+void editorDelChar() {
+    if(E.cy == E.numrows) return;
+    if(E.cx == 0 && E.cy == 0) return;
+
+    erow *row = editorRowAt(E.cy);
+    if(E.cx > 0) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+    } else {
+        erow *prev = editorRowPrev(row);
+        E.cx = prev->size;
+        editorRowAppendString(prev, row->chars, row->size);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+
+/*** UNDO ***/
+
+/* every change made through the row primitives is journaled as one small
+ * record: text put into or taken out of a row, or whole rows inserted or
+ * removed.  records are packed back to back in a chain of arena chunks,
+ * each one pointing back at the one before it in its chunk, and the first
+ * record of every command starts an undo step.  within a step, runs of
+ * typing, of backspacing and of row inserts or deletes at one spot grow
+ * the last record instead of adding one, so d5 and p are one record each */
+
+#define UNDO_RECSIZE(len) ((sizeof(undoRec) + (len) + 7) & ~(size_t)7)
+
+undoRec *undoAt(undoChunk *c, int off) {
+    return (undoRec *)(c->data + off);
+}
+
+void undoFreeChunk(undoChunk *c) {
+    if(c->data) E.undo.resident -= c->cap;
+    free(c->data);
+    free(c);
+}
+
+int undoLoad(undoChunk *c) {
+    struct editorUndo *U = &E.undo;
+    if(c->data) return 0;
+    c->data = malloc(c->cap);
+    if(c->data == NULL) die("malloc");
+    if(pread(U->spillfd, c->data, c->used, c->spill) != c->used) die("pread");
+    U->resident += c->cap;
+    return 0;
+}
+
+/* keeps the journal under THOR_UNDO_MAX bytes by writing the oldest
+ * chunks out to a scratch file, or by forgetting them when that is off */
+void undoTrim() {
+    struct editorUndo *U = &E.undo;
+    undoChunk *c = U->first;
+    while(c && U->resident > THOR_UNDO_MAX) {
+        undoChunk *next = c->next;
+        if(c == U->hc || c == U->tail || c->data == NULL) {
+            c = next;
+            continue;
+        }
+        if(THOR_UNDO_SPILL && U->spillfd == -1) {
+            FILE *fp = tmpfile();
+            if(fp) U->spillfd = dup(fileno(fp));
+            if(fp) fclose(fp);
+        }
+        if(THOR_UNDO_SPILL && U->spillfd != -1) {
+            if(c->spill == -1) {
+                if(pwrite(U->spillfd, c->data, c->used, U->spillend) != c->used) break;
+                c->spill = U->spillend;
+                U->spillend += c->used;
+            }
+            free(c->data);
+            c->data = NULL;
+            U->resident -= c->cap;
+        } else {
+            if(c != U->first) break;
+            U->first = next;
+            next->prev = NULL;
+            undoFreeChunk(c);
+        }
+        c = next;
+    }
+}
+
+/* recording after an undo throws away what could have been redone */
+void undoTruncate() {
+    struct editorUndo *U = &E.undo;
+    undoChunk *keep = U->hc;
+    undoChunk *c = keep ? keep->next : U->first;
+    while(c) {
+        undoChunk *next = c->next;
+        undoFreeChunk(c);
+        c = next;
+    }
+    if(keep) {
+        keep->used = U->hoff + UNDO_RECSIZE(undoAt(keep, U->hoff)->len);
+        keep->last = U->hoff;
+        keep->spill = -1;
+        keep->next = NULL;
+        U->tail = keep;
+    } else {
+        U->first = U->tail = NULL;
+    }
+}
+
+/* room is how much more the record may grow in place */
+undoRec *undoAppend(int len, int room) {
+    struct editorUndo *U = &E.undo;
+    size_t size = UNDO_RECSIZE(len);
+    undoChunk *t = U->tail;
+    if(t == NULL || (size_t)(t->cap - t->used) < size) {
+        undoChunk *c = calloc(1, sizeof(undoChunk));
+        if(c == NULL) die("calloc");
+        size_t cap = UNDO_RECSIZE(len + room);
+        c->cap = cap > THOR_UNDO_CHUNK ? cap : THOR_UNDO_CHUNK;
+        c->data = malloc(c->cap);
+        if(c->data == NULL) die("malloc");
+        c->last = -1;
+        c->spill = -1;
+        c->prev = t;
+        if(t) t->next = c;
+        else U->first = c;
+        U->tail = t = c;
+        U->resident += c->cap;
+    }
+
+    undoRec *r = undoAt(t, t->used);
+    r->prev = t->last;
+    r->len = len;
+    t->last = t->used;
+    t->used += size;
+    t->spill = -1;
+    U->hc = t;
+    U->hoff = t->last;
+    return r;
+}
+
+/* makes room for extra bytes in the newest record; when its chunk is
+ * full the record moves on to a new one with as much room again */
+undoRec *undoGrow(int extra) {
+    struct editorUndo *U = &E.undo;
+    undoChunk *c = U->hc;
+    undoRec *r = undoAt(c, U->hoff);
+    size_t size = UNDO_RECSIZE(r->len + extra);
+    if(U->hoff + size <= (size_t)c->cap) {
+        c->used = U->hoff + size;
+        c->spill = -1;
+        return r;
+    }
+
+    undoRec head = *r;
+    char *data = malloc(r->len);
+    if(data == NULL) die("malloc");
+    memcpy(data, r + 1, r->len);
+    c->used = U->hoff;
+    c->last = r->prev;
+    if(c->used == 0) {
+        if(c->prev) c->prev->next = NULL;
+        else U->first = NULL;
+        U->tail = c->prev;
+        undoFreeChunk(c);
+    }
+
+    r = undoAppend(head.len + extra, head.len + extra);
+    r->kind = head.kind;
+    r->group = head.group;
+    r->line = head.line;
+    r->col = head.col;
+    r->len = head.len;
+    memcpy(r + 1, data, head.len);
+    free(data);
+    return r;
+}
+
+undoRec *undoNew(int kind, int line, int col, int len) {
+    struct editorUndo *U = &E.undo;
+    undoTruncate();
+    undoRec *r = undoAppend(len, 0);
+    r->kind = kind;
+    r->group = U->pending;
+    r->line = line;
+    r->col = col;
+    U->pending = 0;
+    U->sealed = 0;
+    return r;
+}
+
+/* the record a change may still be folded into; never one from an
+ * earlier step */
+undoRec *undoLast() {
+    struct editorUndo *U = &E.undo;
+    if(U->sealed || U->pending || U->hc == NULL) return NULL;
+    return undoAt(U->hc, U->hoff);
+}
+
+void editorUndoText(int kind, int line, int col, const char *s, int len) {
+    struct editorUndo *U = &E.undo;
+    if(U->suspended || len <= 0) return;
+
+    undoRec *r = undoLast();
+    if(r && r->kind == kind && r->line == line) {
+        if(kind == UNDO_INSERT && col == r->col + r->len) {
+            r = undoGrow(len);
+            memcpy((char *)(r + 1) + r->len, s, len);
+            r->len += len;
+            U->pending = 0;
+            undoTrim();
+            return;
+        }
+        if(kind == UNDO_DELETE && (col == r->col || col + len == r->col)) {
+            r = undoGrow(len);
+            char *data = (char *)(r + 1);
+            if(col == r->col) {
+                memcpy(data + r->len, s, len);
+            } else {
+                memmove(data + len, data, r->len);
+                memcpy(data, s, len);
+                r->col = col;
+            }
+            r->len += len;
+            U->pending = 0;
+            undoTrim();
+            return;
+        }
+    }
+
+    r = undoNew(kind, line, col, len);
+    memcpy(r + 1, s, len);
+    undoTrim();
+}
+
+/* rows are kept newline terminated, col counts them.  s is either one row
+ * or a stretch of the mapping holding several, carriage returns and all;
+ * they come off when the rows are put back, like ropeMaterialize does */
+void editorUndoRows(int kind, int line, const char *s, int len, int lines) {
+    struct editorUndo *U = &E.undo;
+    if(U->suspended) return;
+
+    int nl = len == 0 || s[len - 1] != '\n';
+    undoRec *r = undoLast();
+    if(r && !U->pending && r->kind == kind &&
+            ((kind == UNDO_ROWS_IN && line == r->line + r->col) ||
+             (kind == UNDO_ROWS_OUT && line == r->line))) {
+        r = undoGrow(len + nl);
+    } else {
+        r = undoNew(kind, line, 0, len + nl);
+        r->len = 0;
+    }
+    char *data = (char *)(r + 1) + r->len;
+    memcpy(data, s, len);
+    if(nl) data[len] = '\n';
+    r->len += len + nl;
+    r->col += lines;
+    undoTrim();
+}
+
+void editorUndoBegin() {
+    E.undo.pending = 1;
+}
+
+/* applies a record, or its inverse when undoing, without journaling it */
+void undoApply(undoRec *r, int undo) {
+    int kind = r->kind;
+    if(undo) {
+        if(kind == UNDO_INSERT) kind = UNDO_DELETE;
+        else if(kind == UNDO_DELETE) kind = UNDO_INSERT;
+        else if(kind == UNDO_ROWS_IN) kind = UNDO_ROWS_OUT;
+        else if(kind == UNDO_ROWS_OUT) kind = UNDO_ROWS_IN;
+    }
+    char *data = (char *)(r + 1);
+
+    E.undo.suspended++;
+    E.cy = r->line;
+    E.cx = 0;
+    if(kind == UNDO_INSERT || kind == UNDO_DELETE) {
+        erow *row = editorRowAt(r->line);
+        if(row) {
+            if(kind == UNDO_INSERT) editorRowInsertString(row, r->col, data, r->len);
+            else editorRowDelRange(row, r->col, r->len);
+            E.cx = r->col;
+        }
+    } else if(kind == UNDO_ROWS_IN) {
+        char *p = data;
+        for(int j = 0; j < r->col; j++) {
+            char *nl = memchr(p, '\n', data + r->len - p);
+            char *le = nl;
+            while(le > p && le[-1] == '\r') le--;
+            editorInsertRow(r->line + j, p, le - p);
+            p = nl + 1;
+        }
+    } else if(kind == UNDO_ROWS_OUT) {
+        editorDelRows(r->line, r->col);
+    } else {
+        for(char *p = data; p < data + r->len; ) {
+            undoSubst s;
+            memcpy(&s, p, sizeof(s));
+            char *old = p + sizeof(s);
+            char *new = old + s.oldlen;
+            erow *row = editorRowAt(s.line);
+            if(row) {
+                if(undo) editorRowReplace(row, s.col, s.newlen, old, s.oldlen);
+                else editorRowReplace(row, s.col, s.oldlen, new, s.newlen);
+                E.cy = s.line;
+            }
+            p = new + s.newlen;
+        }
+    }
+    E.undo.suspended--;
+
+    if(E.cy > E.numrows) E.cy = E.numrows;
+}
+
+int undoPrev(undoChunk **c, int *off) {
+    undoRec *r = undoAt(*c, *off);
+    if(r->prev >= 0) {
+        *off = r->prev;
+        return 1;
+    }
+    if((*c)->prev == NULL) return 0;
+    *c = (*c)->prev;
+    undoLoad(*c);
+    *off = (*c)->last;
+    return 1;
+}
+
+int undoNext(undoChunk **c, int *off) {
+    struct editorUndo *U = &E.undo;
+    if(*c == NULL) {
+        if(U->first == NULL) return 0;
+        *c = U->first;
+        undoLoad(*c);
+        *off = 0;
+        return 1;
+    }
+    int next = *off + UNDO_RECSIZE(undoAt(*c, *off)->len);
+    if(next < (*c)->used) {
+        *off = next;
+        return 1;
+    }
+    if((*c)->next == NULL) return 0;
+    *c = (*c)->next;
+    undoLoad(*c);
+    *off = 0;
+    return 1;
+}
+
+void editorUndo() {
+    struct editorUndo *U = &E.undo;
+    if(U->hc == NULL) {
+        editorSetStatusMessage("Already at the oldest change");
+        return;
+    }
+
+    /* the start of the step may have been forgotten, then leave it be */
+    undoChunk *c = U->hc;
+    int off = U->hoff;
+    while(!undoAt(c, off)->group) {
+        if(!undoPrev(&c, &off)) {
+            editorSetStatusMessage("Older changes were forgotten");
+            return;
+        }
+    }
+
+    int group;
+    do {
+        undoRec *r = undoAt(U->hc, U->hoff);
+        group = r->group;
+        undoApply(r, 1);
+        if(!undoPrev(&U->hc, &U->hoff)) U->hc = NULL;
+    } while(!group);
+    U->sealed = 1;
+    undoTrim();
+    editorSetStatusMessage("Back to the past");
+}
+
+void editorRedo() {
+    struct editorUndo *U = &E.undo;
+    undoChunk *c = U->hc;
+    int off = U->hoff;
+    if(!undoNext(&c, &off)) {
+        editorSetStatusMessage("Already at the newest change");
+        return;
+    }
+
+    do {
+        U->hc = c;
+        U->hoff = off;
+        undoApply(undoAt(c, off), 0);
+    } while(undoNext(&c, &off) && !undoAt(c, off)->group);
+    U->sealed = 1;
+    undoTrim();
+    editorSetStatusMessage("Back to the future");
+}
+
+/*** FILE I/O ***/
+
+/* saves stream a snapshot of the buffer into a temp file next to the
+ * original with batched writev calls and only rename it into place once
+ * it is synced, so a crash never leaves a half written file.  runs of
+ * extents that still point into the mapping are copied straight from the
+ * original with copy_file_range.  the writing happens on its own thread,
+ * so editing goes on while a slow disk catches up */
+
+struct saveWriter {
+    struct saveJob *job;
+    int fd;
+    int piped;
+    struct iovec iov[THOR_SAVE_IOV];
+    int n;
+    size_t copy_off;
+    size_t copy_len;
+};
+
+void saveProgress(struct saveWriter *w, size_t r) {
+    __atomic_add_fetch(&w->job->written, r, __ATOMIC_RELAXED);
+    if(!__atomic_exchange_n(&w->job->woken, 1, __ATOMIC_RELAXED)) editorWake();
+}
+
+int saveFlushIov(struct saveWriter *w) {
+    struct iovec *iov = w->iov;
+    int n = w->n;
+    while(n > 0) {
+        ssize_t r = writev(w->fd, iov, n);
+        if(r == -1) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        saveProgress(w, r);
+        while(n > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0) {
+            iov->iov_base = (char *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    w->n = 0;
+    return 0;
+}
+
+int saveFlushCopy(struct saveWriter *w) {
+    while(w->copy_len > 0) {
+        size_t len = w->copy_len < THOR_SAVE_STEP ? w->copy_len : THOR_SAVE_STEP;
+        loff_t off = w->copy_off;
+        ssize_t r = w->piped ? 0 : copy_file_range(w->job->mapfd, &off, w->fd, NULL, len, 0);
+        if(r <= 0) {
+            if(r == -1 && errno == EINTR) continue;
+            /* no in-kernel copy between these two, go through the mapping */
+            r = write(w->fd, w->job->map + w->copy_off, len);
+            if(r == -1 && errno == EINTR) continue;
+            if(r <= 0) return -1;
+        }
+        w->copy_off += r;
+        w->copy_len -= r;
+        saveProgress(w, r);
+    }
+    return 0;
+}
+
+int saveBytes(struct saveWriter *w, const char *p, size_t len) {
+    if(w->copy_len && saveFlushCopy(w) == -1) return -1;
+    while(len > 0) {
+        size_t step = len < THOR_SAVE_STEP ? len : THOR_SAVE_STEP;
+        if(w->n == THOR_SAVE_IOV && saveFlushIov(w) == -1) return -1;
+        w->iov[w->n].iov_base = (char *)p;
+        w->iov[w->n].iov_len = step;
+        w->n++;
+        p += step;
+        len -= step;
+    }
+    return 0;
+}
+
+int saveMapped(struct saveWriter *w, size_t off, size_t len) {
+    if(w->n && saveFlushIov(w) == -1) return -1;
+    if(w->copy_len && w->copy_off + w->copy_len == off) {
+        w->copy_len += len;
+        return 0;
+    }
+    if(w->copy_len && saveFlushCopy(w) == -1) return -1;
+    w->copy_off = off;
+    w->copy_len = len;
+    return 0;
+}
+
+/* the snapshot copies only materialized rows, back to back with the
+ * buffer's line endings, and refers to everything else by its offset in
+ * the mapping, whose lines already end that way */
+
+void saveAddPiece(struct saveJob *job, int mapped, size_t off, size_t len) {
+    savePiece *last = job->npieces ? &job->pieces[job->npieces - 1] : NULL;
+    if(last && last->mapped == mapped && last->mapped != 2 && last->off + last->len == off) {
+        last->len += len;
+    } else {
+        if(job->npieces == job->cap) {
+            job->cap = job->cap ? job->cap * 2 : 64;
+            job->pieces = realloc(job->pieces, sizeof(savePiece) * job->cap);
+            if(job->pieces == NULL) die("realloc");
+        }
+        job->pieces[job->npieces].mapped = mapped;
+        job->pieces[job->npieces].off = off;
+        job->pieces[job->npieces].len = len;
+        job->pieces[job->npieces].mem = NULL;
+        job->npieces++;
+    }
+    job->total += len;
+}
+
+/* decoded blocks and the mappings of other buffers stay put until thor
+ * exits, so their extents are written from where they are */
+void saveAddMemory(struct saveJob *job, const char *p, size_t len) {
+    savePiece *last = job->npieces ? &job->pieces[job->npieces - 1] : NULL;
+    if(last && last->mapped == 2 && last->mem + last->len == p) {
+        last->len += len;
+        job->total += len;
+        return;
+    }
+    saveAddPiece(job, 2, 0, len);
+    job->pieces[job->npieces - 1].mem = p;
+}
+
+void saveAddBytes(struct saveJob *job, const char *p, size_t len, int nl) {
+    if(job->nbytes + len + 2 > job->bcap) {
+        while(job->nbytes + len + 2 > job->bcap)
+            job->bcap = job->bcap ? job->bcap * 2 : 4096;
+        job->bytes = realloc(job->bytes, job->bcap);
+        if(job->bytes == NULL) die("realloc");
+    }
+    memcpy(job->bytes + job->nbytes, p, len);
+    if(nl && job->crlf) job->bytes[job->nbytes + len++] = '\r';
+    if(nl) job->bytes[job->nbytes + len++] = '\n';
+    saveAddPiece(job, 0, job->nbytes, len);
+    job->nbytes += len;
+}
+
+/* an extent from a file with the other kind of line ending is written a
+ * line at a time, so the saved file keeps to one */
+void saveAddLines(struct saveJob *job, const char *p, size_t len) {
+    const char *end = p + len;
+    while(p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *le = nl ? nl : end;
+        const char *ls = le;
+        while(ls > p && ls[-1] == '\r') ls--;
+        saveAddBytes(job, p, ls - p, 1);
+        p = nl ? nl + 1 : end;
+    }
+}
+
+void editorSaveSnapshot(struct saveJob *job) {
+    erow *e = NULL;
+    if(E.rope->count) {
+        int slot, off;
+        ropeNode *leaf = ropeLeafFor(0, &slot, &off);
+        e = leaf->u.rows[slot];
+    }
+    for(; e; e = ropeEntryNext(e)) {
+        /* extents pasted from another buffer point into its mapping,
+         * which this file's descriptor knows nothing about */
+        if(e->mapped && (E.map == NULL || e->chars < E.map ||
+                    e->chars >= E.map + E.mapsize)) {
+            if(editorLinesCrlf(e->chars, e->size) == job->crlf) {
+                saveAddMemory(job, e->chars, e->size);
+                if(e->size && e->chars[e->size - 1] != '\n') saveAddBytes(job, "", 0, 1);
+            } else {
+                saveAddLines(job, e->chars, e->size);
+            }
+        } else if(e->mapped) {
+            saveAddPiece(job, 1, e->chars - E.map, e->size);
+            /* only the very end of the file can lack its newline */
+            if(e->size && e->chars[e->size - 1] != '\n') saveAddBytes(job, "", 0, 1);
+        } else {
+            saveAddBytes(job, e->chars, e->size, 1);
+        }
+    }
+}
+
+/* runs argv with its stdin and stdout on in and out; the child gets the
+ * default SIGPIPE back and keeps its complaints off the screen */
+pid_t editorSpawn(char **argv, int in, int out) {
+    pid_t pid = fork();
+    if(pid != 0) return pid;
+    signal(SIGPIPE, SIG_DFL);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if(null != -1) dup2(null, STDERR_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+}
+
+/* a compressed file is written through its compressor, which writes the
+ * temp file; the copies out of the mapping then go through the pipe */
+void *editorSaveMain(void *arg) {
+    struct saveJob *job = arg;
+    struct saveWriter w;
+    w.job = job;
+    w.fd = job->fd;
+    w.piped = 0;
+    w.n = 0;
+    w.copy_len = 0;
+
+    int ok = 1;
+    pid_t pid = -1;
+    if(job->codec) {
+        int p[2];
+        ok = pipe2(p, O_CLOEXEC) == 0;
+        if(ok) {
+            pid = editorSpawn(job->codec->encode, p[0], job->fd);
+            close(p[0]);
+            if(pid == -1) close(p[1]);
+            ok = pid != -1;
+            w.fd = p[1];
+            w.piped = 1;
+        }
+    }
+
+    for(int i = 0; ok && i < job->npieces; i++) {
+        savePiece *p = &job->pieces[i];
+        if(p->mapped == 2) ok = saveBytes(&w, p->mem, p->len) == 0;
+        else if(p->mapped) ok = saveMapped(&w, p->off, p->len) == 0;
+        else ok = saveBytes(&w, job->bytes + p->off, p->len) == 0;
+    }
+    ok = ok && saveFlushIov(&w) == 0 && saveFlushCopy(&w) == 0;
+    if(pid != -1) {
+        int status;
+        close(w.fd);
+        while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+        if(ok && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            ok = 0;
+            errno = EPIPE;
+        }
+    }
+    ok = ok && fsync(job->fd) == 0;
+    if(close(job->fd) == -1) ok = 0;
+    if(ok && rename(job->tmp, job->path) == 0) {
+        job->err = 0;
+    } else {
+        job->err = errno ? errno : EIO;
+        unlink(job->tmp);
+    }
+
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    editorWake();
+    return NULL;
+}
+
+void editorSaveReap() {
+    struct saveJob *job = E.save;
+    pthread_join(job->thread, NULL);
+    job->running = 0;
+    benchRecord(BENCH_SAVE, job->started);
+    if(job->err == 0) {
+        /* the file on disk is the new starting point: the journal goes
+         * with it, unless there were changes since the snapshot, which
+         * are still in memory and start a new journal of their own */
+        if(E.dirty == job->dirty) {
+            E.dirty = 0;
+            editorSwapReset();
+            if(E.swap.path == NULL) editorSwapPath();
+        } else {
+            editorSwapDrop();
+        }
+        if(E.follow.on) editorFollowReopen(job->written);
+        if(job->codec)
+            editorSetStatusMessage("%zu bytes written to disk through %s", job->written, job->codec->name);
+        else
+            editorSetStatusMessage("%zu bytes written to disk", job->written);
+    } else {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+    }
+    free(job->pieces);
+    free(job->bytes);
+    free(job->path);
+    free(job->tmp);
+    job->pieces = NULL;
+    job->bytes = NULL;
+    job->path = job->tmp = NULL;
+}
+
+/* called from the event loop: reaps a finished save, or asks for a redraw
+ * so the progress in the status bar moves */
+int editorSavePoll() {
+    struct saveJob *job = E.save;
+    if(!job->running) return 0;
+    __atomic_store_n(&job->woken, 0, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) editorSaveReap();
+    return 1;
+}
+
+void editorSaveWait() {
+    if(E.save->running) editorSaveReap();
+}
+
+int numPlaces(int n) {
+    int r = 1;
+    if(n < 0) n = (n == INT_MIN) ? INT_MAX : -n;
+    while(n > 9) {
+        n /= 10;
+        r++;
+    }
+    return r;
+}
+
+/* huge files are mmapped instead of read: the mapping is cut on line
+ * boundaries into one part per worker thread, each worker walks its part
+ * and hands out extents of THOR_INDEX_LINES lines, and the main loop
+ * appends them to the rope part after part as unmaterialized entries.
+ *
+ * a worker cannot know whether its part starts inside a comment, so it
+ * scans its part both ways at once and gives every extent the comment
+ * state at its end for either start; the two scans usually meet at the
+ * first comment and from there one does.  the main loop then picks the
+ * right one from the state of the entry before, so jumping anywhere is
+ * never held up by a serial pass over the file */
+
+void *editorIndexerMain(void *arg) {
+    indexPart *part = arg;
+    struct editorIndexer *ix = part->ix;
+    char *map = ix->map;
+    struct editorSyntax *syn = ix->syntax;
+    char *mcs = syn ? syn->multiline_comment_start : NULL;
+    char *mce = syn ? syn->multiline_comment_end : NULL;
+    int scan = mcs && mce && mcs[0] && mce[0];
+
+    int s0 = 0, s1 = 1;
+    size_t off = part->start;
+    while(off < part->end) {
+        size_t start = off;
+        int lines = 0;
+        while(off < part->end && lines < THOR_INDEX_LINES) {
+            char *nl = memchr(map + off, '\n', part->end - off);
+            size_t eol = nl ? (size_t)(nl - map) : part->end;
+            if(scan) {
+                int same = s0 == s1;
+                s0 = editorSyntaxScan(syn, map + off, eol - off, s0);
+                s1 = same ? s0 : editorSyntaxScan(syn, map + off, eol - off, s1);
+            }
+            off = nl ? eol + 1 : part->end;
+            lines++;
+        }
+
+        pthread_mutex_lock(&ix->lock);
+        if(part->produced == part->cap) {
+            part->cap = part->cap ? part->cap * 2 : 256;
+            part->ext = realloc(part->ext, sizeof(mapExtent) * part->cap);
+        }
+        mapExtent *m = &part->ext[part->produced++];
+        m->off = start;
+        m->len = off - start;
+        m->lines = lines;
+        m->out[0] = scan && s0;
+        m->out[1] = scan && s1;
+        pthread_cond_signal(&ix->ready);
+        if(!ix->woken) {
+            ix->woken = 1;
+            editorWake();
+        }
+        pthread_mutex_unlock(&ix->lock);
+    }
+
+    pthread_mutex_lock(&ix->lock);
+    part->done = 1;
+    pthread_cond_signal(&ix->ready);
+    editorWake();
+    pthread_mutex_unlock(&ix->lock);
+    return NULL;
+}
+
+/* the state the entry before ends in is one of the two the previous
+ * extent of the part could end in, which tells which start of the part
+ * it came from; only if an edit made it neither is the extent scanned */
+void editorIndexerResolve(erow *ext, indexPart *part, int j) {
+    erow *prev = ropeEntryPrev(ext);
+    if(E.indexer->hl_gen != E.hl_gen || (prev && prev->state_gen != E.hl_gen)) {
+        editorSyntaxInvalidateRow(ext);
+        return;
+    }
+
+    int in = prev ? prev->hl_open_comment : 0;
+    int s = in;
+    if(j > 0) {
+        mapExtent *before = &part->ext[j - 1];
+        s = before->out[0] == in ? 0 : before->out[1] == in ? 1 : -1;
+    }
+    ext->hl_open_comment = s >= 0 ? part->ext[j].out[s] :
+        editorSyntaxScanExtent(ext, in);
+    ext->state_gen = E.hl_gen;
+}
+
+int editorIndexerIngest() {
+    struct editorIndexer *ix = E.indexer;
+    if(ix == NULL || !ix->running) return 0;
+
+    int added = 0;
+    pthread_mutex_lock(&ix->lock);
+    ix->woken = 0;
+    while(ix->cur < ix->nparts) {
+        indexPart *part = &ix->parts[ix->cur];
+        for(; part->consumed < part->produced; part->consumed++) {
+            mapExtent *m = &part->ext[part->consumed];
+            erow *ext = editorRowNew();
+            ext->mapped = 1;
+            ext->chars = E.map + m->off;
+            ext->size = m->len;
+            ext->lines = m->lines;
+
+            ropeInsert(E.mapline, ext);
+            E.mapline += m->lines;
+            E.numrows += m->lines;
+            editorIndexerResolve(ext, part, part->consumed);
+            erow *next = ropeEntryNext(ext);
+            if(next) next->hl_gen = next->state_gen = 0;
+            added += m->lines;
+        }
+        if(!part->done) break;
+        free(part->ext);
+        part->ext = NULL;
+        ix->cur++;
+    }
+    int done = ix->cur == ix->nparts;
+    pthread_mutex_unlock(&ix->lock);
+
+    if(done) {
+        for(int k = 0; k < ix->nparts; k++)
+            pthread_join(ix->parts[k].thread, NULL);
+        free(ix->parts);
+        ix->parts = NULL;
+        ix->running = 0;
+    }
+    return added;
+}
+
+/* waits until the rope holds line `line` or the whole file */
+void editorIndexerReach(int line) {
+    struct editorIndexer *ix = E.indexer;
+    while(ix && ix->running && E.numrows <= line) {
+        pthread_mutex_lock(&ix->lock);
+        while(ix->cur < ix->nparts) {
+            indexPart *part = &ix->parts[ix->cur];
+            if(part->consumed < part->produced || part->done) break;
+            pthread_cond_wait(&ix->ready, &ix->lock);
+        }
+        pthread_mutex_unlock(&ix->lock);
+        editorIndexerIngest();
+    }
+}
+
+void editorIndexerFinish() {
+    editorIndexerReach(INT_MAX);
+}
+
+/* a buffer keeps the line ending of the first line it was opened with */
+int editorLinesCrlf(const char *p, size_t len) {
+    const char *nl = memchr(p, '\n', len);
+    return nl && nl > p && nl[-1] == '\r';
+}
+
+void editorOpenLarge(int fd, size_t size) {
+    E.map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(E.map == MAP_FAILED) die("mmap");
+    E.mapsize = size;
+    E.mapfd = dup(fd);
+    E.crlf = editorLinesCrlf(E.map, size);
+    madvise(E.map, size, MADV_SEQUENTIAL);
+
+    /* the workers outlive a switch to another buffer, so the indexer
+     * they share must not move when E is parked */
+    struct editorIndexer *ix = calloc(1, sizeof(*ix));
+    if(ix == NULL) die("calloc");
+    E.indexer = ix;
+    pthread_mutex_init(&ix->lock, NULL);
+    pthread_cond_init(&ix->ready, NULL);
+    ix->map = E.map;
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) n = 1;
+    if(n > THOR_INDEX_THREADS) n = THOR_INDEX_THREADS;
+    ix->parts = calloc(n, sizeof(indexPart));
+    if(ix->parts == NULL) die("calloc");
+    ix->nparts = n;
+    ix->cur = 0;
+    ix->syntax = E.syntax;
+    ix->hl_gen = E.hl_gen;
+
+    size_t at = 0;
+    for(int k = 0; k < n; k++) {
+        indexPart *part = &ix->parts[k];
+        part->ix = ix;
+        part->start = at;
+        if(k == n - 1) {
+            at = size;
+        } else {
+            size_t cut = size / n * (k + 1);
+            if(cut < at) cut = at;
+            char *nl = memchr(E.map + cut, '\n', size - cut);
+            at = nl ? (size_t)(nl - E.map) + 1 : size;
+        }
+        part->end = at;
+    }
+
+    ix->running = 1;
+    for(int k = 0; k < n; k++) {
+        if(pthread_create(&ix->parts[k].thread, NULL, editorIndexerMain,
+                    &ix->parts[k]) != 0)
+            die("pthread_create");
+    }
+
+    /* wait for the first extent so the first frame has something to draw */
+    pthread_mutex_lock(&ix->lock);
+    while(ix->parts[0].produced == 0 && !ix->parts[0].done)
+        pthread_cond_wait(&ix->ready, &ix->lock);
+    pthread_mutex_unlock(&ix->lock);
+    editorIndexerIngest();
+}
+
+/* compressed files are unpacked by a child process into a pipe.  a thread
+ * reads it into blocks of THOR_DECODE_BLOCK bytes, cut after their last
+ * newline, and hands out extents over them like the indexer does over a
+ * mapping, comment state included; the main loop hangs them after the
+ * last one.  the blocks are the buffer from then on, so nothing is kept
+ * twice and rows show up while the rest is still being unpacked */
+
+editorCodec *editorCodecSniff(const unsigned char *magic, int len) {
+    for(unsigned int j = 0; j < CODEC_ENTRIES; j++) {
+        editorCodec *c = &CODECS[j];
+        if(len >= c->magiclen && memcmp(magic, c->magic, c->magiclen) == 0) return c;
+    }
+    return NULL;
+}
+
+editorCodec *editorCodecByName(const char *filename) {
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    if(ext == NULL) return NULL;
+    for(unsigned int j = 0; j < CODEC_ENTRIES; j++)
+        if(strcmp(ext, CODECS[j].ext) == 0) return &CODECS[j];
+    return NULL;
+}
+
+void editorDecodeCut(struct editorDecoder *dc, char *block, size_t len, int *state) {
+    struct editorSyntax *syn = dc->syntax;
+    char *mcs = syn ? syn->multiline_comment_start : NULL;
+    char *mce = syn ? syn->multiline_comment_end : NULL;
+    int scan = mcs && mce && mcs[0] && mce[0];
+
+    size_t off = 0;
+    while(off < len) {
+        size_t start = off;
+        int in = *state;
+        int lines = 0;
+        while(off < len && lines < THOR_INDEX_LINES) {
+            char *nl = memchr(block + off, '\n', len - off);
+            size_t eol = nl ? (size_t)(nl - block) : len;
+            if(scan) *state = editorSyntaxScan(syn, block + off, eol - off, *state);
+            off = nl ? eol + 1 : len;
+            lines++;
+        }
+
+        pthread_mutex_lock(&dc->lock);
+        if(dc->produced == dc->cap) {
+            dc->cap = dc->cap ? dc->cap * 2 : 256;
+            dc->ext = realloc(dc->ext, sizeof(decodeExtent) * dc->cap);
+            if(dc->ext == NULL) die("realloc");
+        }
+        decodeExtent *m = &dc->ext[dc->produced++];
+        m->chars = block + start;
+        m->len = off - start;
+        m->lines = lines;
+        m->in = in;
+        m->out = *state;
+        pthread_cond_signal(&dc->ready);
+        if(!dc->woken) {
+            dc->woken = 1;
+            editorWake();
+        }
+        pthread_mutex_unlock(&dc->lock);
+    }
+}
+
+void *editorDecodeMain(void *arg) {
+    struct editorDecoder *dc = arg;
+    size_t cap = THOR_DECODE_BLOCK, used = 0;
+    char *block = malloc(cap);
+    if(block == NULL) die("malloc");
+    int state = 0, eof = 0;
+
+    while(!eof) {
+        ssize_t r = read(dc->fd, block + used, cap - used);
+        if(r == -1 && errno == EINTR) continue;
+        if(r <= 0) eof = 1;
+        else used += r;
+        if(!eof && used < cap) continue;
+
+        /* the partial line at the end starts the next block */
+        size_t keep = used;
+        if(!eof) {
+            char *nl = memrchr(block, '\n', used);
+            if(nl == NULL) {
+                cap *= 2;
+                block = realloc(block, cap);
+                if(block == NULL) die("realloc");
                 continue;
             }
+            keep = nl - block + 1;
+        }
+        if(keep == 0) break;
+
+        char *next = NULL;
+        size_t tail = used - keep;
+        if(!eof) {
+            cap = tail * 2 > THOR_DECODE_BLOCK ? tail * 2 : THOR_DECODE_BLOCK;
+            next = malloc(cap);
+            if(next == NULL) die("malloc");
+            memcpy(next, block + keep, tail);
+        }
+        char *fit = realloc(block, keep);
+        editorDecodeCut(dc, fit ? fit : block, keep, &state);
+        block = next;
+        used = tail;
+    }
+    free(block);
+    close(dc->fd);
+
+    int status;
+    while(waitpid(dc->pid, &status, 0) == -1 && errno == EINTR);
+    pthread_mutex_lock(&dc->lock);
+    dc->status = status;
+    dc->done = 1;
+    pthread_cond_signal(&dc->ready);
+    editorWake();
+    pthread_mutex_unlock(&dc->lock);
+    return NULL;
+}
+
+int editorDecodeIngest() {
+    struct editorDecoder *dc = E.decoder;
+    if(dc == NULL || !dc->running) return 0;
+
+    int added = 0;
+    pthread_mutex_lock(&dc->lock);
+    dc->woken = 0;
+    for(; dc->consumed < dc->produced; dc->consumed++) {
+        decodeExtent *m = &dc->ext[dc->consumed];
+        erow *ext = editorRowNew();
+        ext->mapped = 1;
+        ext->chars = m->chars;
+        ext->size = m->len;
+        ext->lines = m->lines;
+
+        ropeInsert(E.mapline, ext);
+        E.mapline += m->lines;
+        E.numrows += m->lines;
+
+        /* the thread assumed the file up to here is as it unpacked it */
+        erow *prev = ropeEntryPrev(ext);
+        int in = prev ? prev->hl_open_comment : 0;
+        if(dc->syntax != E.syntax || (prev && prev->state_gen != E.hl_gen)) {
+            editorSyntaxInvalidateRow(ext);
+        } else {
+            ext->hl_open_comment = in == m->in ? m->out : editorSyntaxScanExtent(ext, in);
+            ext->state_gen = E.hl_gen;
+        }
+        erow *next = ropeEntryNext(ext);
+        if(next) next->hl_gen = next->state_gen = 0;
+        added += m->lines;
+    }
+    int done = dc->done;
+    pthread_mutex_unlock(&dc->lock);
+
+    if(done) {
+        pthread_join(dc->thread, NULL);
+        free(dc->ext);
+        dc->ext = NULL;
+        dc->running = 0;
+        if(!WIFEXITED(dc->status) || WEXITSTATUS(dc->status) != 0)
+            editorSetStatusMessage("%s choked on %s, this is all it gave", dc->codec->name, E.filename);
+    }
+    return added || done;
+}
+
+void editorDecodeReach(int line) {
+    struct editorDecoder *dc = E.decoder;
+    while(dc && dc->running && E.numrows <= line) {
+        pthread_mutex_lock(&dc->lock);
+        while(dc->consumed == dc->produced && !dc->done)
+            pthread_cond_wait(&dc->ready, &dc->lock);
+        pthread_mutex_unlock(&dc->lock);
+        editorDecodeIngest();
+    }
+}
+
+void editorDecodeFinish() {
+    editorDecodeReach(INT_MAX);
+}
+
+void editorOpenCompressed(int fd, editorCodec *codec) {
+    int p[2];
+    if(pipe2(p, O_CLOEXEC) == -1) die("pipe");
+
+    /* like the indexer, the thread outlives a switch to another buffer */
+    struct editorDecoder *dc = calloc(1, sizeof(*dc));
+    if(dc == NULL) die("calloc");
+    E.decoder = dc;
+    pthread_mutex_init(&dc->lock, NULL);
+    pthread_cond_init(&dc->ready, NULL);
+    dc->codec = codec;
+    dc->syntax = E.syntax;
+    dc->fd = p[0];
+    dc->pid = editorSpawn(codec->decode, fd, p[1]);
+    close(p[1]);
+    if(dc->pid == -1) die("fork");
+
+    dc->running = 1;
+    if(pthread_create(&dc->thread, NULL, editorDecodeMain, dc) != 0)
+        die("pthread_create");
+
+    /* wait for the first extent so the first frame has something to draw */
+    pthread_mutex_lock(&dc->lock);
+    while(dc->produced == 0 && !dc->done)
+        pthread_cond_wait(&dc->ready, &dc->lock);
+    pthread_mutex_unlock(&dc->lock);
+    editorDecodeIngest();
+    if(E.rope->count) {
+        int slot, off;
+        ropeNode *leaf = ropeLeafFor(0, &slot, &off);
+        erow *first = leaf->u.rows[slot];
+        E.crlf = editorLinesCrlf(first->chars, first->size);
+    }
+}
+
+void editorOpen(char *filename) {
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+    editorSwapPath();
+    if(E.swap.path && access(E.swap.path, F_OK) == 0)
+        editorSetStatusMessage("Found swap file %s from an earlier session", E.swap.path);
+
+    FILE *fp = fopen(filename, "re");
+    if(!fp) die("fopen");
+
+    unsigned char magic[4];
+    int n = pread(fileno(fp), magic, sizeof(magic), 0);
+    E.codec = editorCodecSniff(magic, n);
+    if(E.codec) {
+        editorOpenCompressed(fileno(fp), E.codec);
+        fclose(fp);
+        E.dirty = 0;
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fileno(fp), &st) == 0 && st.st_size >= THOR_LARGE_FILE) {
+        editorOpenLarge(fileno(fp), st.st_size);
+        fclose(fp);
+        E.dirty = 0;
+        E.follow.off = st.st_size;
+        E.follow.nl = E.map[st.st_size - 1] == '\n';
+        return;
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    E.swap.suspended = 1;
+    E.undo.suspended++;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        if(E.follow.off == 0) E.crlf = editorLinesCrlf(line, linelen);
+        E.follow.off += linelen;
+        E.follow.nl = line[linelen - 1] == '\n';
+        while(linelen > 0 && (line[linelen - 1] == '\n' ||
+                    line[linelen - 1] == '\r'))
+            linelen--;
+        editorInsertRow(E.numrows, line, linelen);
+    }
+    free(line);
+    fclose(fp);
+    E.swap.suspended = 0;
+    E.undo.suspended--;
+    E.dirty = 0;
+}
+
+void editorSave() {
+    if(E.follow.dropped) {
+        editorSetStatusMessage("Not saving, the top %lld lines of this log were let go", E.follow.dropped);
+        return;
+    }
+    if(E.filename == NULL) {
+        E.filename = editorPrompt("Save as '%s'", NULL);
+        if(E.filename == NULL) {
+            editorSetStatusMessage("Save aborted, didn't want to save huh?");
+            return;
+        }
+        E.codec = editorCodecByName(E.filename);
+        editorSelectSyntaxHighlight();
+        editorSwapPath();
+    }
+
+    editorIndexerFinish();
+    editorDecodeFinish();
+    editorSaveWait();
+
+    struct saveJob *job = E.save;
+    job->path = E.bench.on ? NULL : realpath(E.filename, NULL);
+    if(job->path == NULL) job->path = strdup(E.bench.on ? E.bench.out : E.filename);
+    job->tmp = malloc(strlen(job->path) + 8);
+    sprintf(job->tmp, "%s.XXXXXX", job->path);
+
+    job->fd = mkstemp(job->tmp);
+    if(job->fd == -1) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        free(job->path);
+        free(job->tmp);
+        job->path = job->tmp = NULL;
+        return;
+    }
+
+    struct stat st;
+    if(stat(job->path, &st) == 0) {
+        fchmod(job->fd, st.st_mode & 07777);
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(job->fd, 0644 & ~mask);
+    }
+
+    job->npieces = job->cap = 0;
+    job->nbytes = job->bcap = 0;
+    job->total = job->written = 0;
+    job->done = job->woken = 0;
+    job->dirty = E.dirty;
+    job->started = benchStart();
+    job->map = E.map;
+    job->mapfd = E.mapfd;
+    job->codec = E.codec;
+    job->crlf = E.crlf;
+    editorSaveSnapshot(job);
+    /* until the save is known to have made it the journal is all that can
+     * bring the buffer back, so what it still holds in memory goes out
+     * now and later changes wait for the save to finish */
+    if(E.swap.nops || E.swap.nrows) editorSwapFlush();
+
+    job->running = 1;
+    if(pthread_create(&job->thread, NULL, editorSaveMain, job) != 0)
+        die("pthread_create");
+    if(E.bench.on) editorSaveWait();
+}
+
+/* the swap file is an append only journal of what changed since the file
+ * was last saved: row inserts and deletes as they happened, then the
+ * final text of every row touched since the previous flush, or of every
+ * line in a pasted stretch of the mapping.  replaying it
+ * on top of the saved file gives back the buffer.  it is only written
+ * every E.autosave seconds while there are changes, never when that is
+ * 0 (see :autosave) or under --bench, and only for the rows that changed */
+
+void editorSwapPath() {
+    struct editorSwap *sw = &E.swap;
+    free(sw->path);
+    sw->path = NULL;
+    if(E.filename == NULL || E.autosave == 0 || E.bench.on) return;
+
+    char *slash = strrchr(E.filename, '/');
+    int dirlen = slash ? slash - E.filename + 1 : 0;
+    sw->path = malloc(strlen(E.filename) + 6);
+    sprintf(sw->path, "%.*s.%s.swp", dirlen, E.filename, E.filename + dirlen);
+}
+
+void editorSwapArm() {
+    if(E.swap.due == 0) E.swap.due = time(NULL) + E.autosave;
+}
+
+void editorSwapRow(erow *row) {
+    struct editorSwap *sw = &E.swap;
+    if(sw->path == NULL || sw->suspended || row->swapdirty) return;
+    if(sw->nrows == sw->rowcap) {
+        sw->rowcap = sw->rowcap ? sw->rowcap * 2 : 64;
+        sw->rows = realloc(sw->rows, sizeof(erow *) * sw->rowcap);
+        if(sw->rows == NULL) die("realloc");
+    }
+    sw->rows[sw->nrows++] = row;
+    row->swapdirty = sw->nrows;
+    editorSwapArm();
+}
+
+/* swapdirty is the row's slot in the list plus one */
+void editorSwapForget(erow *row) {
+    E.swap.rows[row->swapdirty - 1] = NULL;
+    row->swapdirty = 0;
+}
+
+void editorSwapOp(char kind, int at, int n) {
+    struct editorSwap *sw = &E.swap;
+    if(sw->path == NULL || sw->suspended) return;
+
+    swapOp *last = sw->nops ? &sw->ops[sw->nops - 1] : NULL;
+    if(last && last->kind == kind &&
+            ((kind == 'd' && last->at == at) || (kind == 'i' && last->at + last->n == at))) {
+        last->n += n;
+        return;
+    }
+    if(sw->nops == sw->opcap) {
+        sw->opcap = sw->opcap ? sw->opcap * 2 : 64;
+        sw->ops = realloc(sw->ops, sizeof(swapOp) * sw->opcap);
+        if(sw->ops == NULL) die("realloc");
+    }
+    sw->ops[sw->nops].kind = kind;
+    sw->ops[sw->nops].at = at;
+    sw->ops[sw->nops].n = n;
+    sw->nops++;
+    editorSwapArm();
+}
+
+void editorSwapClear() {
+    struct editorSwap *sw = &E.swap;
+    for(int j = 0; j < sw->nrows; j++)
+        if(sw->rows[j]) sw->rows[j]->swapdirty = 0;
+    sw->nrows = 0;
+    sw->nops = 0;
+    sw->due = 0;
+}
+
+void editorSwapFlush() {
+    struct editorSwap *sw = &E.swap;
+    if(sw->path == NULL) return;
+    if(E.save->running) {
+        sw->due = time(NULL) + 1;
+        return;
+    }
+
+    struct abuf ab = ABUF_INIT;
+    char head[64];
+    if(sw->fd == -1) {
+        sw->fd = open(sw->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(sw->fd == -1) {
+            editorSwapClear();
+            return;
+        }
+        abAppend(&ab, "thor swap 1\n", 12);
+        abAppend(&ab, E.filename, strlen(E.filename));
+        abAppend(&ab, "\n", 1);
+    }
+
+    for(int j = 0; j < sw->nops; j++) {
+        int len = snprintf(head, sizeof(head), "%c %d %d\n",
+                sw->ops[j].kind, sw->ops[j].at, sw->ops[j].n);
+        abAppend(&ab, head, len);
+    }
+    for(int j = 0; j < sw->nrows; j++) {
+        erow *row = sw->rows[j];
+        if(row == NULL) continue;
+        int len;
+        if(row->mapped)
+            len = snprintf(head, sizeof(head), "R %d %d %d\n",
+                    editorRowIndex(row), row->lines, row->size);
+        else
+            len = snprintf(head, sizeof(head), "r %d %d\n", editorRowIndex(row), row->size);
+        abAppend(&ab, head, len);
+        abAppend(&ab, row->chars, row->size);
+        if(!row->mapped || row->size == 0 || row->chars[row->size - 1] != '\n')
+            abAppend(&ab, "\n", 1);
+    }
+    editorSwapClear();
+
+    for(int off = 0; off < ab.len; ) {
+        ssize_t r = write(sw->fd, ab.b + off, ab.len - off);
+        if(r == -1 && errno == EINTR) continue;
+        if(r <= 0) break;
+        off += r;
+    }
+    abFree(&ab);
+}
+
+/* removes the swap file but keeps what hasn't been written to it yet */
+void editorSwapDrop() {
+    struct editorSwap *sw = &E.swap;
+    if(sw->fd != -1) {
+        close(sw->fd);
+        sw->fd = -1;
+    }
+    if(sw->path) unlink(sw->path);
+}
+
+/* after a save the file on disk is the new starting point */
+void editorSwapReset() {
+    editorSwapClear();
+    editorSwapDrop();
+}
+
+/* a buffer with changes the journal never saw can't start journaling
+ * halfway, so turning autosave on only reaches it after its next save */
+void editorAutosaveSet(int secs) {
+    struct editorBuffers *bl = &E.bufs;
+    E.autosave = secs;
+    editorBufferPark(&bl->list[bl->cur]);
+    for(int k = 0; k < bl->n; k++) {
+        editorBufferLoad(&bl->list[k]);
+        if(secs == 0) {
+            editorSwapReset();
+            free(E.swap.path);
+            E.swap.path = NULL;
+        } else if(E.swap.path == NULL && !E.dirty) {
+            editorSwapPath();
+        }
+        editorBufferPark(&bl->list[k]);
+    }
+    editorBufferLoad(&bl->list[bl->cur]);
+    if(secs) editorSetStatusMessage("Writing a swap file every %d seconds", secs);
+    else editorSetStatusMessage("No more swap files, living dangerously");
+}
+
+/*** REGEX ***/
+
+/* search patterns are parsed into a tree, compiled to a Thompson NFA and
+ * from there to a DFA in one go, before any byte is looked at, so the
+ * scan itself is one table lookup per byte and never backtracks.  a line
+ * is walked twice: backwards through the DFA of the reversed pattern,
+ * which stops in an accepting state wherever a match starts, and then
+ * forwards from each start through the DFA of the pattern for the
+ * longest match there.  text every match must hold goes to searchFind
+ * first, so most lines are never run through a DFA at all.
+ *
+ * it knows . [] [^] * + ? | () and \d \w \s with their capital
+ * negations; ^ and $ anchor only at the very start and end */
+
+enum reOp {
+    RE_EMPTY = 0,
+    RE_LIT,
+    RE_CAT,
+    RE_ALT,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST
+};
+
+enum reInstOp {
+    RI_SET = 0,
+    RI_SPLIT,
+    RI_MATCH
+};
+
+typedef struct reNode {
+    int op;
+    int a;
+    int b;
+} reNode;
+
+typedef struct reInst {
+    int op;
+    int out;
+    int out1;
+    int set;
+} reInst;
+
+typedef struct reCompiler {
+    const char *s;
+    const char *end;
+    const char *err;
+    reNode *node;
+    int nnode;
+    int nodecap;
+    unsigned char (*set)[32];
+    int nset;
+    int setcap;
+    reInst *inst;
+    int ninst;
+    int instcap;
+} reCompiler;
+
+int reNewNode(reCompiler *c, int op, int a, int b) {
+    if(c->nnode == c->nodecap) {
+        c->nodecap = c->nodecap ? c->nodecap * 2 : 64;
+        c->node = realloc(c->node, sizeof(reNode) * c->nodecap);
+        if(c->node == NULL) die("realloc");
+    }
+    c->node[c->nnode].op = op;
+    c->node[c->nnode].a = a;
+    c->node[c->nnode].b = b;
+    return c->nnode++;
+}
+
+int reNewSet(reCompiler *c) {
+    if(c->nset == c->setcap) {
+        c->setcap = c->setcap ? c->setcap * 2 : 16;
+        c->set = realloc(c->set, sizeof(*c->set) * c->setcap);
+        if(c->set == NULL) die("realloc");
+    }
+    memset(c->set[c->nset], 0, sizeof(*c->set));
+    return c->nset++;
+}
+
+#define RE_HAS(set, b) ((set)[(unsigned char)(b) >> 3] & (1 << ((unsigned char)(b) & 7)))
+
+void reSetAdd(unsigned char *set, int from, int to) {
+    for(int b = from; b <= to; b++) set[b >> 3] |= 1 << (b & 7);
+}
+
+/* \d \w \s and their negations; 0 if e is no class */
+int reSetClass(unsigned char *set, int e) {
+    unsigned char tmp[32];
+    memset(tmp, 0, sizeof(tmp));
+    switch(tolower(e)) {
+        case 'd': reSetAdd(tmp, '0', '9'); break;
+        case 'w': reSetAdd(tmp, '0', '9'); reSetAdd(tmp, 'a', 'z');
+                  reSetAdd(tmp, 'A', 'Z'); reSetAdd(tmp, '_', '_'); break;
+        case 's': reSetAdd(tmp, ' ', ' '); reSetAdd(tmp, '\t', '\r'); break;
+        default: return 0;
+    }
+    for(int i = 0; i < 32; i++) set[i] |= isupper(e) ? ~tmp[i] : tmp[i];
+    return 1;
+}
+
+int reEscape(int e) {
+    if(e == 't') return '\t';
+    if(e == 'n') return '\n';
+    return e;
+}
+
+int reParseAlt(reCompiler *c);
+
+int reParseClass(reCompiler *c) {
+    int k = reNewSet(c);
+    int negate = c->s < c->end && *c->s == '^';
+    if(negate) c->s++;
+    int first = 1;
+    while(c->s < c->end && (*c->s != ']' || first)) {
+        first = 0;
+        int lo = (unsigned char)*c->s++;
+        if(lo == '\\' && c->s < c->end) {
+            int e = (unsigned char)*c->s++;
+            if(reSetClass(c->set[k], e)) continue;
+            lo = reEscape(e);
+        }
+        int hi = lo;
+        if(c->s + 1 < c->end && *c->s == '-' && c->s[1] != ']') {
+            c->s++;
+            hi = (unsigned char)*c->s++;
+            if(hi == '\\' && c->s < c->end) hi = reEscape((unsigned char)*c->s++);
+            if(hi < lo) {
+                c->err = "a range that runs backwards";
+                return -1;
+            }
+        }
+        reSetAdd(c->set[k], lo, hi);
+    }
+    if(c->s == c->end) {
+        c->err = "a [ that never closes";
+        return -1;
+    }
+    c->s++;
+    if(negate) for(int i = 0; i < 32; i++) c->set[k][i] = ~c->set[k][i];
+    return reNewNode(c, RE_LIT, k, 0);
+}
+
+int reParseAtom(reCompiler *c) {
+    int ch = (unsigned char)*c->s++;
+    if(ch == '(') {
+        int n = reParseAlt(c);
+        if(n == -1) return -1;
+        if(c->s == c->end || *c->s != ')') {
+            c->err = "a ( that never closes";
+            return -1;
+        }
+        c->s++;
+        return n;
+    }
+    if(ch == '[') return reParseClass(c);
+    if(ch == '*' || ch == '+' || ch == '?') {
+        c->err = "nothing to repeat";
+        return -1;
+    }
+
+    int k = reNewSet(c);
+    if(ch == '.') {
+        reSetAdd(c->set[k], 0, 255);
+    } else if(ch == '\\') {
+        if(c->s == c->end) {
+            c->err = "a \\ with nothing after it";
+            return -1;
+        }
+        int e = (unsigned char)*c->s++;
+        if(!reSetClass(c->set[k], e)) reSetAdd(c->set[k], reEscape(e), reEscape(e));
+    } else {
+        reSetAdd(c->set[k], ch, ch);
+    }
+    return reNewNode(c, RE_LIT, k, 0);
+}
+
+int reParseRepeat(reCompiler *c) {
+    int n = reParseAtom(c);
+    while(n != -1 && c->s < c->end && strchr("*+?", *c->s)) {
+        int op = *c->s == '*' ? RE_STAR : *c->s == '+' ? RE_PLUS : RE_QUEST;
+        c->s++;
+        n = reNewNode(c, op, n, 0);
+    }
+    return n;
+}
+
+int reParseCat(reCompiler *c) {
+    int n = reNewNode(c, RE_EMPTY, 0, 0);
+    while(c->s < c->end && *c->s != '|' && *c->s != ')') {
+        int a = reParseRepeat(c);
+        if(a == -1) return -1;
+        n = c->node[n].op == RE_EMPTY ? a : reNewNode(c, RE_CAT, n, a);
+    }
+    return n;
+}
+
+int reParseAlt(reCompiler *c) {
+    int n = reParseCat(c);
+    while(n != -1 && c->s < c->end && *c->s == '|') {
+        c->s++;
+        int b = reParseCat(c);
+        n = b == -1 ? -1 : reNewNode(c, RE_ALT, n, b);
+    }
+    return n;
+}
+
+int reNewInst(reCompiler *c, int op, int out, int out1, int set) {
+    if(c->ninst == c->instcap) {
+        c->instcap = c->instcap ? c->instcap * 2 : 64;
+        c->inst = realloc(c->inst, sizeof(reInst) * c->instcap);
+        if(c->inst == NULL) die("realloc");
+    }
+    c->inst[c->ninst].op = op;
+    c->inst[c->ninst].out = out;
+    c->inst[c->ninst].out1 = out1;
+    c->inst[c->ninst].set = set;
+    return c->ninst++;
+}
+
+/* compiled back to front: every node is emitted knowing the instruction
+ * that follows it, and the reversed pattern only swaps the halves of a
+ * concatenation */
+int reEmit(reCompiler *c, int n, int next, int rev) {
+    reNode node = c->node[n];
+    int loop, body;
+    switch(node.op) {
+        case RE_LIT:
+            return reNewInst(c, RI_SET, next, -1, node.a);
+        case RE_CAT:
+            if(rev) return reEmit(c, node.b, reEmit(c, node.a, next, rev), rev);
+            return reEmit(c, node.a, reEmit(c, node.b, next, rev), rev);
+        case RE_ALT:
+            return reNewInst(c, RI_SPLIT, reEmit(c, node.a, next, rev),
+                    reEmit(c, node.b, next, rev), -1);
+        case RE_STAR:
+        case RE_PLUS:
+            loop = reNewInst(c, RI_SPLIT, -1, next, -1);
+            body = reEmit(c, node.a, loop, rev);
+            c->inst[loop].out = body;
+            return node.op == RE_STAR ? loop : body;
+        case RE_QUEST:
+            return reNewInst(c, RI_SPLIT, reEmit(c, node.a, next, rev), next, -1);
+    }
+    return next;
+}
+
+/* bytes that every set of the pattern either holds or lacks together
+ * end up in one class */
+void reClasses(reCompiler *c, reDfa *d) {
+    unsigned char next[256];
+    memset(d->cls, 0, sizeof(d->cls));
+    d->nclass = 1;
+    for(int k = 0; k < c->nset; k++) {
+        int id[512];
+        int n = 0;
+        for(int j = 0; j < 512; j++) id[j] = -1;
+        for(int b = 0; b < 256; b++) {
+            int key = d->cls[b] * 2 + (RE_HAS(c->set[k], b) != 0);
+            if(id[key] == -1) id[key] = n++;
+            next[b] = id[key];
+        }
+        memcpy(d->cls, next, sizeof(next));
+        d->nclass = n;
+    }
+}
+
+typedef struct reBuilder {
+    int *pool;
+    int npool;
+    int poolcap;
+    int *off;
+    int *len;
+    int cap;
+    int hash[THOR_REGEX_STATES * 2];
+    int *mark;
+    int gen;
+    int *stack;
+    int *list;
+} reBuilder;
+
+int reCompareInt(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* the instructions that consume a byte or match, reachable from seeds
+ * without consuming one, sorted so equal sets look equal */
+int reClosure(reCompiler *c, reBuilder *b, int *seeds, int nseeds) {
+    int n = 0, sp = 0;
+    b->gen++;
+    for(int j = 0; j < nseeds; j++) b->stack[sp++] = seeds[j];
+    while(sp > 0) {
+        int i = b->stack[--sp];
+        if(b->mark[i] == b->gen) continue;
+        b->mark[i] = b->gen;
+        if(c->inst[i].op == RI_SPLIT) {
+            b->stack[sp++] = c->inst[i].out1;
+            b->stack[sp++] = c->inst[i].out;
+        } else {
+            b->list[n++] = i;
+        }
+    }
+    qsort(b->list, n, sizeof(int), reCompareInt);
+    return n;
+}
+
+int reAddState(reCompiler *c, reBuilder *b, reDfa *d, int n) {
+    unsigned int h = 2166136261u;
+    for(int j = 0; j < n; j++) h = (h ^ b->list[j]) * 16777619u;
+    unsigned int mask = THOR_REGEX_STATES * 2 - 1;
+    for(h &= mask; b->hash[h] != -1; h = (h + 1) & mask) {
+        int k = b->hash[h];
+        if(b->len[k] == n && !memcmp(b->pool + b->off[k], b->list, n * sizeof(int)))
+            return k;
+    }
+    if(d->nstates == THOR_REGEX_STATES) return -1;
+
+    int k = d->nstates++;
+    if(k == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 64;
+        b->off = realloc(b->off, sizeof(int) * b->cap);
+        b->len = realloc(b->len, sizeof(int) * b->cap);
+        d->next = realloc(d->next, sizeof(int) * b->cap * d->nclass);
+        d->accept = realloc(d->accept, b->cap);
+        if(!b->off || !b->len || !d->next || !d->accept) die("realloc");
+    }
+    if(b->npool + n > b->poolcap) {
+        while(b->npool + n > b->poolcap) b->poolcap = b->poolcap ? b->poolcap * 2 : 256;
+        b->pool = realloc(b->pool, sizeof(int) * b->poolcap);
+        if(b->pool == NULL) die("realloc");
+    }
+    memcpy(b->pool + b->npool, b->list, n * sizeof(int));
+    b->off[k] = b->npool;
+    b->len[k] = n;
+    b->npool += n;
+    b->hash[h] = k;
+
+    d->accept[k] = 0;
+    for(int j = 0; j < n; j++)
+        if(c->inst[b->list[j]].op == RI_MATCH) d->accept[k] = 1;
+    memset(d->next + k * d->nclass, 0, sizeof(int) * d->nclass);
+    return k;
+}
+
+/* subset construction from start, every state and every class */
+int reBuildDfa(reCompiler *c, reDfa *d, int start) {
+    reBuilder b;
+    memset(&b, 0, sizeof(b));
+    for(int j = 0; j < THOR_REGEX_STATES * 2; j++) b.hash[j] = -1;
+    b.mark = calloc(c->ninst, sizeof(int));
+    b.stack = malloc(sizeof(int) * c->ninst * 2);
+    b.list = malloc(sizeof(int) * c->ninst);
+    int *seeds = malloc(sizeof(int) * c->ninst);
+    if(!b.mark || !b.stack || !b.list || !seeds) die("malloc");
+
+    reClasses(c, d);
+    int rep[256];
+    for(int x = 255; x >= 0; x--) rep[d->cls[x]] = x;
+
+    int ok = 1;
+    reAddState(c, &b, d, 0);
+    d->start = reAddState(c, &b, d, reClosure(c, &b, &start, 1));
+    for(int k = 1; ok && k < d->nstates; k++) {
+        for(int x = 0; x < d->nclass; x++) {
+            int nseeds = 0;
+            for(int j = 0; j < b.len[k]; j++) {
+                reInst *in = &c->inst[b.pool[b.off[k] + j]];
+                if(in->op == RI_SET && RE_HAS(c->set[in->set], rep[x])) seeds[nseeds++] = in->out;
+            }
+            int to = reAddState(c, &b, d, reClosure(c, &b, seeds, nseeds));
+            if(to == -1) {
+                ok = 0;
+                break;
+            }
+            d->next[k * d->nclass + x] = to;
+        }
+    }
+
+    free(b.pool);
+    free(b.off);
+    free(b.len);
+    free(b.mark);
+    free(b.stack);
+    free(b.list);
+    free(seeds);
+    return ok ? 0 : -1;
+}
+
+/* the longest run of plain characters the top level of the pattern is
+ * made of; a match can't be anywhere this text isn't */
+void reMust(reCompiler *c, int n, char *run, int *rlen, char *best, int *blen) {
+    reNode *node = &c->node[n];
+    if(node->op == RE_CAT) {
+        reMust(c, node->a, run, rlen, best, blen);
+        reMust(c, node->b, run, rlen, best, blen);
+        return;
+    }
+    int only = -1, count = 0;
+    if(node->op == RE_LIT) {
+        for(int b = 0; b < 256 && count < 2; b++)
+            if(RE_HAS(c->set[node->a], b)) {
+                only = b;
+                count++;
+            }
+    }
+    if(count != 1) {
+        *rlen = 0;
+        return;
+    }
+    run[(*rlen)++] = only;
+    if(*rlen > *blen) {
+        *blen = *rlen;
+        memcpy(best, run, *rlen);
+    }
+}
+
+void searchPatternFree(searchPattern *pat) {
+    if(pat == NULL) return;
+    free(pat->query);
+    free(pat->must);
+    free(pat->fwd.next);
+    free(pat->fwd.accept);
+    free(pat->rev.next);
+    free(pat->rev.accept);
+    free(pat);
+}
+
+/* a query without any of the special characters stays plain text and
+ * goes to searchFind alone, like it always did */
+searchPattern *searchCompile(const char *query, int qlen, const char **err) {
+    searchPattern *pat = calloc(1, sizeof(searchPattern));
+    if(pat == NULL) die("calloc");
+    pat->query = malloc(qlen + 1);
+    if(pat->query == NULL) die("malloc");
+    memcpy(pat->query, query, qlen);
+    pat->query[qlen] = '\0';
+    pat->qlen = qlen;
+    pat->literal = strpbrk(pat->query, "\\.[]()*+?|^$") == NULL;
+    if(pat->literal) return pat;
+
+    reCompiler c;
+    memset(&c, 0, sizeof(c));
+    c.s = query;
+    c.end = query + qlen;
+    if(c.s < c.end && *c.s == '^') {
+        pat->bol = 1;
+        c.s++;
+    }
+    if(c.end > c.s && c.end[-1] == '$') {
+        int slashes = 0;
+        for(const char *p = c.end - 2; p >= c.s && *p == '\\'; p--) slashes++;
+        if(slashes % 2 == 0) {
+            pat->eol = 1;
+            c.end--;
+        }
+    }
+
+    int root = reParseAlt(&c);
+    if(root != -1 && c.s < c.end) {
+        c.err = "a ) that was never opened";
+        root = -1;
+    }
+    if(root != -1) {
+        char *run = malloc(qlen + 1);
+        pat->must = malloc(qlen + 1);
+        if(run == NULL || pat->must == NULL) die("malloc");
+        int rlen = 0;
+        reMust(&c, root, run, &rlen, pat->must, &pat->mustlen);
+        free(run);
+
+        int fstart = reEmit(&c, root, reNewInst(&c, RI_MATCH, -1, -1, -1), 0);
+        int rstart = -1;
+        if(!pat->bol) {
+            rstart = reEmit(&c, root, reNewInst(&c, RI_MATCH, -1, -1, -1), 1);
+            if(!pat->eol) {
+                /* unanchored at the end: any bytes may come after a match */
+                int k = reNewSet(&c);
+                reSetAdd(c.set[k], 0, 255);
+                int any = reNewInst(&c, RI_SET, -1, -1, k);
+                rstart = reNewInst(&c, RI_SPLIT, any, rstart, -1);
+                c.inst[any].out = rstart;
+            }
+        }
+        if(reBuildDfa(&c, &pat->fwd, fstart) == -1 ||
+                (rstart != -1 && reBuildDfa(&c, &pat->rev, rstart) == -1)) {
+            c.err = "more states than I can keep track of";
+            root = -1;
         }
+    }
 
-        if(prev_sep) {
-            int j;
-            for(j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if(kw2) klen--;
-
-                if(!strncmp(&row->render[i], keywords[j], klen) &&
-                        is_separator(row->render[i + klen])) {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
+    free(c.node);
+    free(c.set);
+    free(c.inst);
+    if(root == -1) {
+        if(err) *err = c.err;
+        searchPatternFree(pat);
+        return NULL;
+    }
+    return pat;
+}
+
+/* the end of the longest match starting at s, or -1; with whole the match
+ * has to run to the end of the line */
+int reForward(const reDfa *d, const char *line, int s, int len, int whole) {
+    int state = d->start;
+    int last = d->accept[state] ? s : -1;
+    for(int p = s; p < len; p++) {
+        state = d->next[state * d->nclass + d->cls[(unsigned char)line[p]]];
+        if(state == 0) return whole ? -1 : last;
+        if(d->accept[state]) last = p + 1;
+    }
+    return whole ? (d->accept[state] ? len : -1) : last;
+}
+
+/* like reForward, but remembering the state every position was reached
+ * in: a later scan that gets somewhere in the same state as the one
+ * before can only end where that one did, so it stops there.  without
+ * this every start of a line full of them would run to its end */
+int reForwardShared(const reDfa *d, const char *line, int s, int len, reScratch *rs) {
+    int state = d->start;
+    int last = d->accept[state] ? s : -1;
+    int p = s;
+    while(1) {
+        if(rs->state[p] == state) {
+            if(rs->end[p] > last) last = rs->end[p];
+            break;
+        }
+        rs->state[p] = state;
+        if(p == len) {
+            p++;
+            break;
+        }
+        state = d->next[state * d->nclass + d->cls[(unsigned char)line[p++]]];
+        if(state == 0) break;
+        if(d->accept[state]) last = p;
+    }
+    for(int q = s; q < p; q++) rs->end[q] = last >= q ? last : -1;
+    return last;
+}
+
+void reScratchFree(reScratch *rs) {
+    free(rs->at);
+    free(rs->state);
+    free(rs->end);
+}
+
+void searchListAdd(struct searchList *l, int line, int col, int len, const char *p, int left);
+
+/* every match in one line, leftmost longest and not overlapping, or just
+ * the first one */
+void reLine(struct searchList *l, const searchPattern *pat, const char *ls, int len,
+        int line, int all, reScratch *rs) {
+    if(pat->bol) {
+        int e = reForward(&pat->fwd, ls, 0, len, pat->eol);
+        if(e >= 0) searchListAdd(l, line, 0, e, ls, len);
+        return;
+    }
+
+    const reDfa *d = &pat->rev;
+    int state = d->start;
+    rs->n = 0;
+    for(int i = len; ; i--) {
+        if(d->accept[state]) {
+            if(rs->n == rs->cap) {
+                rs->cap = rs->cap ? rs->cap * 2 : 64;
+                rs->at = realloc(rs->at, sizeof(int) * rs->cap);
+                if(rs->at == NULL) die("realloc");
             }
-            if(keywords[j] != NULL) {
-                prev_sep = 0;
-                continue;
+            rs->at[rs->n++] = i;
+        }
+        if(i == 0) break;
+        state = d->next[state * d->nclass + d->cls[(unsigned char)ls[i - 1]]];
+        if(state == 0) break;
+    }
+
+    int shared = all && !pat->eol && rs->n > 1;
+    if(shared) {
+        if(len + 1 > rs->lcap) {
+            rs->lcap = (len + 1) * 2;
+            rs->state = realloc(rs->state, sizeof(int) * rs->lcap);
+            rs->end = realloc(rs->end, sizeof(int) * rs->lcap);
+            if(rs->state == NULL || rs->end == NULL) die("realloc");
+        }
+        int first = rs->at[rs->n - 1];
+        memset(rs->state + first, -1, sizeof(int) * (len + 1 - first));
+    }
+
+    int from = 0;
+    for(int k = rs->n - 1; k >= 0; k--) {
+        int s = rs->at[k];
+        if(s < from) continue;
+        int e = pat->eol ? len : shared ? reForwardShared(&pat->fwd, ls, s, len, rs) :
+            reForward(&pat->fwd, ls, s, len, 0);
+        searchListAdd(l, line, s, e - s, ls + s, len - s);
+        if(!all) break;
+        from = e > s ? e : s + 1;
+    }
+}
+
+/*** FIND ***/
+
+/* substring kernel: compare sixteen candidate positions at a time against
+ * the first and last byte of the needle and only memcmp where both hit */
+const char *searchFind(const char *hay, size_t len, const char *needle, size_t n) {
+    if(n == 0 || n > len) return NULL;
+    if(n == 1) return memchr(hay, needle[0], len);
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    for(; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + n - 1));
+        unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask) {
+            int bit = __builtin_ctz(mask);
+            if(!memcmp(hay + i + bit + 1, needle + 1, n - 2)) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while(i + n <= len) {
+        const char *p = memchr(hay + i, needle[0], len - n + 1 - i);
+        if(p == NULL) return NULL;
+        if(p[n - 1] == needle[n - 1] && !memcmp(p + 1, needle + 1, n - 2)) return p;
+        i = p - hay + 1;
+    }
+    return NULL;
+}
+
+/* newlines in a stretch of text, sixteen bytes at a time */
+int editorCountLines(const char *p, size_t len) {
+    int n = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for(; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(a, nl)));
+    }
+#endif
+    for(; i < len; i++) n += p[i] == '\n';
+    return n;
+}
+
+/* a line of an extent is blank when it holds nothing but its line end */
+int editorBlankAt(const char *ls, const char *end) {
+    while(ls < end && *ls == '\r') ls++;
+    return ls == end || *ls == '\n';
+}
+
+/* the line of extent e at or past (or before) line `off` of it that is
+ * blank, or isn't.  going forward to a blank line jumps between "\n\n"
+ * and "\n\r" hits straight through the text, so paragraph motions over a
+ * mapped file never look at the lines in between one by one */
+int editorExtentFind(erow *e, int off, int dir, int blank) {
+    const char *p = e->chars;
+    const char *end = e->chars + e->size;
+    const char *ls = p;
+    for(int j = 0; j < off; j++) ls = (const char *)memchr(ls, '\n', end - ls) + 1;
+
+    if(dir > 0 && blank) {
+        const char *nn = ls - 1, *nr = ls - 1;
+        while(1) {
+            if(editorBlankAt(ls, end)) return off;
+            if(nn < ls) {
+                nn = searchFind(ls, end - ls, "\n\n", 2);
+                if(nn == NULL) nn = end;
+            }
+            if(nr < ls) {
+                nr = searchFind(ls, end - ls, "\n\r", 2);
+                if(nr == NULL) nr = end;
             }
+            const char *hit = nn < nr ? nn : nr;
+            if(hit >= end) return -1;
+            off += editorCountLines(ls, hit + 1 - ls);
+            ls = hit + 1;
         }
+    }
 
-        prev_sep = is_separator(c);
-        i++;
+    while(1) {
+        if(editorBlankAt(ls, end) == blank) return off;
+        if(dir > 0) {
+            const char *nl = memchr(ls, '\n', end - ls);
+            if(nl == NULL || ++off == e->lines) return -1;
+            ls = nl + 1;
+        } else {
+            if(off-- == 0) return -1;
+            const char *nl = ls - 1 > p ? memrchr(p, '\n', ls - 1 - p) : NULL;
+            ls = nl ? nl + 1 : p;
+        }
     }
+}
 
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if(changed && row->idx + 1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx + 1]); 
+/* the first line from `from` on (or back) that is blank, or isn't */
+int editorFindLine(int from, int dir, int blank) {
+    if(from < 0 || from >= E.numrows) return -1;
+    int slot, off;
+    ropeNode *leaf = ropeLeafFor(from, &slot, &off);
+    erow *e = leaf->u.rows[slot];
+    int line = from - off;
+    while(e) {
+        if(!e->mapped) {
+            if((e->size == 0) == blank) return line;
+        } else {
+            int k = editorExtentFind(e, off, dir, blank);
+            if(k >= 0) return line + k;
+        }
+        if(dir > 0) {
+            line += e->lines;
+            e = ropeEntryNext(e);
+            off = 0;
+        } else {
+            e = ropeEntryPrev(e);
+            if(e) {
+                line -= e->lines;
+                off = e->lines - 1;
+            }
+        }
+    }
+    return -1;
 }
 
+/* a query is scanned into per-chunk match lists holding every match, so
+ * the arrows just step through them and the screen can show them all.
+ * typing more of a plain query only re-checks the lines that already
+ * matched */
 
-int editorSyntaxToColor(int hl) {
-    switch(hl) {
-        case HL_COMMENT: 
-        case HL_MLCOMMENT: return 96;
-        case HL_KEYWORD1: return 93;
-        case HL_KEYWORD2: return 92;
-        case HL_STRING: return 95;
-        case HL_NUMBER: return 91;
-        case HL_MATCH: return 43;
-        default: return 37;
+void searchListAdd(struct searchList *l, int line, int col, int len, const char *p, int left) {
+    if(l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->m = realloc(l->m, sizeof(struct searchMatch) * l->cap);
+        if(l->m == NULL) die("realloc");
     }
+    l->m[l->n].line = line;
+    l->m[l->n].col = col;
+    l->m[l->n].len = len;
+    l->m[l->n].p = p;
+    l->m[l->n].left = left;
+    l->n++;
 }
 
-void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if(E.filename == NULL) return;
+/* where a line of a block ends for matching: extent lines still carry
+ * the \r of a CRLF file, which the row they turn into drops */
+const char *searchLineEnd(const searchSegment *seg, const char *ls, const char *le) {
+    if(seg->mapped)
+        while(le > ls && le[-1] == '\r') le--;
+    return le;
+}
 
-    char *ext = strrchr(E.filename, '.');
+/* a block is one row or a whole unmaterialized extent; rows never hold a
+ * newline, so the same walk covers both.  without all only the first
+ * match of each line is kept */
+void searchBlock(struct searchList *l, const searchSegment *seg, const searchPattern *pat,
+        int all, reScratch *rs) {
+    const char *p = seg->p;
+    const char *end = seg->p + seg->len;
+    const char *ls = p;
+    int line = seg->line;
+    const char *key = pat->literal ? pat->query : pat->must;
+    int klen = pat->literal ? pat->qlen : pat->mustlen;
+
+    if(klen == 0) {
+        /* nothing to look for first, every line goes through the DFA */
+        while(1) {
+            const char *le = memchr(ls, '\n', end - ls);
+            if(le == NULL) le = end;
+            reLine(l, pat, ls, searchLineEnd(seg, ls, le) - ls, line, all, rs);
+            if(le == end || le + 1 == end) break;
+            ls = le + 1;
+            line++;
+        }
+        return;
+    }
 
-    for(unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while(s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            if((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                    (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                E.syntax = s;
+    while(p < end) {
+        const char *hit = searchFind(p, end - p, key, klen);
+        if(hit == NULL) break;
 
-                int filerow;
-                for(filerow = 0; filerow < E.numrows; filerow++) {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
-                return;
+        const char *nl;
+        while((nl = memchr(ls, '\n', hit - ls)) != NULL) {
+            ls = nl + 1;
+            line++;
+        }
+        const char *le = memchr(hit, '\n', end - hit);
+        if(le == NULL) le = end;
+        const char *te = searchLineEnd(seg, ls, le);
+        if(pat->literal) {
+            while(hit && hit + klen <= te) {
+                searchListAdd(l, line, hit - ls, klen, hit, te - hit);
+                if(!all) break;
+                hit = searchFind(hit + klen, te - hit - klen, key, klen);
             }
-            i++;
+        } else {
+            reLine(l, pat, ls, te - ls, line, all, rs);
         }
+
+        if(le == end) break;
+        ls = p = le + 1;
+        line++;
     }
 }
 
-/*** ROW OPERATIONS ***/
+void searchListRefine(struct searchList *l, const searchPattern *pat, reScratch *rs) {
+    struct searchList out = {NULL, 0, 0};
+    for(int j = 0; j < l->n; j++) {
+        struct searchMatch *m = &l->m[j];
+        if(j > 0 && l->m[j - 1].line == m->line) continue;
+        searchSegment seg = {m->p - m->col, m->col + m->left, m->line, 0};
+        searchBlock(&out, &seg, pat, 1, rs);
+    }
+    free(l->m);
+    *l = out;
+}
 
-int editorRowCxToRx(erow *row, int cx) {
-    int rx = 0;
-    int j;
-    for(j = 0; j < cx; j++) {
-        if(row->chars[j] == '\t')
-            rx += (THOR_TAB_STOP - 1) - (rx % THOR_TAB_STOP);
-        rx++;
+/* big buffers are cut into chunks of about THOR_SEARCH_CHUNK bytes and
+ * scanned by a pool of worker threads, starting with the chunk under the
+ * cursor.  the workers only ever see a snapshot of (bytes, line) pairs
+ * taken when the scan starts, never the rope, and they post each finished
+ * chunk through the wake pipe so the prompt keeps taking keys meanwhile */
+
+int searchRunJob(struct searchScan *sc, int j, struct searchList *l) {
+    struct searchJob *job = &sc->jobs[j];
+    reScratch rs = RESCRATCH_INIT;
+    int ok = 1;
+    for(int i = job->first; ok && i < job->last; i++) {
+        if(__atomic_load_n(&sc->cancelled, __ATOMIC_RELAXED)) ok = 0;
+        else searchBlock(l, &sc->seg[i], sc->pat, 1, &rs);
     }
-    return rx;
+    reScratchFree(&rs);
+    return ok;
 }
 
-int editorRowRxToCx(erow *row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for(cx = 0; cx < row->size; cx++) {
-        if(row->chars[cx] == '\t')
-            cur_rx += (THOR_TAB_STOP - 1) - (cur_rx % THOR_TAB_STOP);
-        cur_rx++;
+void *editorSearchWorker(void *arg) {
+    struct searchPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1) {
+        struct searchScan *sc = pool->current;
+        if(sc == NULL || sc->next == sc->njobs) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        int j = sc->order[sc->next++];
+        sc->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct searchList found = {NULL, 0, 0};
+        int ok = searchRunJob(sc, j, &found);
+
+        pthread_mutex_lock(&pool->lock);
+        if(ok && !sc->cancelled) {
+            sc->jobs[j].found = found;
+            sc->jobs[j].done = 1;
+            sc->finished++;
+            sc->matches += found.n;
+            if(!pool->woken) {
+                pool->woken = 1;
+                editorWake();
+            }
+        } else {
+            free(found.m);
+        }
+        sc->active--;
+        pthread_cond_broadcast(&pool->posted);
+    }
+    return NULL;
+}
+
+void editorSearchStartPool() {
+    struct searchPool *pool = &E.search.pool;
+    if(pool->threads) return;
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) n = 1;
+    if(n > THOR_SEARCH_THREADS) n = THOR_SEARCH_THREADS;
 
-        if(cur_rx > rx) return cx;
+    pool->threads = malloc(sizeof(pthread_t) * n);
+    if(pool->threads == NULL) die("malloc");
+    for(pool->nthreads = 0; pool->nthreads < n; pool->nthreads++) {
+        if(pthread_create(&pool->threads[pool->nthreads], NULL,
+                    editorSearchWorker, pool) != 0)
+            die("pthread_create");
     }
-    return cx;
 }
 
-void editorUpdateRow(erow *row) {
-    int tabs = 0;
-    int j;
-    for(j = 0; j < row->size; j++)
-        if(row->chars[j] == '\t') tabs++;
+void editorSearchCancel() {
+    struct editorSearch *S = &E.search;
+    struct searchScan *sc = S->scan;
+    if(sc == NULL) return;
+
+    pthread_mutex_lock(&S->pool.lock);
+    __atomic_store_n(&sc->cancelled, 1, __ATOMIC_RELAXED);
+    if(S->pool.current == sc) S->pool.current = NULL;
+    while(sc->active) pthread_cond_wait(&S->pool.posted, &S->pool.lock);
+    pthread_mutex_unlock(&S->pool.lock);
+
+    for(int j = 0; j < sc->njobs; j++) free(sc->jobs[j].found.m);
+    free(sc->jobs);
+    free(sc->order);
+    free(sc->seg);
+    searchPatternFree(sc->pat);
+    free(sc);
+    S->scan = NULL;
+    S->job = -1;
+    S->gen++;
+}
+
+void editorSearchStart(searchPattern *pat) {
+    struct editorSearch *S = &E.search;
+    struct searchScan *sc = calloc(1, sizeof(struct searchScan));
+    if(sc == NULL) die("calloc");
+    sc->pat = pat;
+
+    int nseg = 0, segcap = 0, jobcap = 0;
+    size_t total = 0, chunk = 0;
+    int origin = 0;
+    int line = 0;
+
+    erow *e = NULL;
+    if(E.rope->count) {
+        int slot, off;
+        ropeNode *leaf = ropeLeafFor(0, &slot, &off);
+        e = leaf->u.rows[slot];
+    }
+    for(; e; e = ropeEntryNext(e)) {
+        if(nseg == segcap) {
+            segcap = segcap ? segcap * 2 : 1024;
+            sc->seg = realloc(sc->seg, sizeof(searchSegment) * segcap);
+            if(sc->seg == NULL) die("realloc");
+        }
+        if(chunk == 0) {
+            if(sc->njobs == jobcap) {
+                jobcap = jobcap ? jobcap * 2 : 64;
+                sc->jobs = realloc(sc->jobs, sizeof(struct searchJob) * jobcap);
+                if(sc->jobs == NULL) die("realloc");
+            }
+            memset(&sc->jobs[sc->njobs], 0, sizeof(struct searchJob));
+            sc->jobs[sc->njobs].first = nseg;
+            sc->njobs++;
+        }
+        sc->seg[nseg].p = e->chars;
+        sc->seg[nseg].len = e->size;
+        sc->seg[nseg].line = line;
+        sc->seg[nseg].mapped = e->mapped;
+        nseg++;
+        sc->jobs[sc->njobs - 1].last = nseg;
+
+        if(line <= S->origin) origin = sc->njobs - 1;
+        line += e->lines;
+        total += e->size + 1;
+        chunk += e->size + 1;
+        if(chunk >= THOR_SEARCH_CHUNK) chunk = 0;
+    }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(THOR_TAB_STOP - 1) + 1);
+    sc->order = malloc(sizeof(int) * (sc->njobs ? sc->njobs : 1));
+    if(sc->order == NULL) die("malloc");
+    for(int k = 0; k < sc->njobs; k++)
+        sc->order[k] = (origin + k) % sc->njobs;
 
-    int idx = 0;
-    for(j = 0; j < row->size; j++) {
-        if(row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while(idx % 8 != 0) row->render[idx++] = ' ';
+    S->scan = sc;
+    S->job = -1;
+    S->seen = 0;
+
+    if(total < THOR_SEARCH_SYNC) {
+        for(int j = 0; j < sc->njobs; j++) {
+            searchRunJob(sc, j, &sc->jobs[j].found);
+            sc->jobs[j].done = 1;
+            sc->matches += sc->jobs[j].found.n;
+        }
+        sc->finished = sc->njobs;
+        return;
+    }
+
+    editorSearchStartPool();
+    pthread_mutex_lock(&S->pool.lock);
+    S->pool.current = sc;
+    pthread_cond_broadcast(&S->pool.work);
+    pthread_mutex_unlock(&S->pool.lock);
+}
+
+/* the current match is painted over the row when it is drawn, so the
+ * row's own highlighting is never touched */
+void editorSearchRestoreHighlight() {
+    E.search.hl_line = -1;
+}
+
+void editorSearchSelect(int j, int i) {
+    struct editorSearch *S = &E.search;
+    struct searchMatch *m = &S->scan->jobs[j].found.m[i];
+    S->job = j;
+    S->idx = i;
+
+    editorSearchRestoreHighlight();
+    erow *row = editorRowAt(m->line);
+    E.cy = m->line;
+    E.cx = m->col;
+    E.rowoff = E.numrows;
+
+    S->hl_line = m->line;
+    S->hl_rx = editorRowCxToRx(row, m->col);
+    S->hl_len = editorRowCxToRx(row, m->col + m->len) - S->hl_rx;
+}
+
+/* the matches on one line, for the screen to show; the chunks are in line
+ * order, and matches within one too.  a chunk still being scanned shows
+ * none yet */
+int editorSearchLine(int line, struct searchMatch **first) {
+    struct searchScan *sc = E.search.scan;
+    if(sc == NULL || sc->njobs == 0) return 0;
+
+    int lo = 0, hi = sc->njobs - 1;
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if(sc->seg[sc->jobs[mid].first].line <= line) lo = mid;
+        else hi = mid - 1;
+    }
+    struct searchJob *job = &sc->jobs[lo];
+    if(sc->finished < sc->njobs) {
+        pthread_mutex_lock(&E.search.pool.lock);
+        int done = job->done;
+        pthread_mutex_unlock(&E.search.pool.lock);
+        if(!done) return 0;
+    }
+
+    struct searchList *l = &job->found;
+    lo = 0;
+    hi = l->n;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(l->m[mid].line < line) lo = mid + 1;
+        else hi = mid;
+    }
+    int n = 0;
+    while(lo + n < l->n && l->m[lo + n].line == line) n++;
+    *first = l->m + lo;
+    return n;
+}
+
+/* the first match at or after the line the search started from: walk the
+ * chunks in dispatch order and stop at the first unfinished one, so a
+ * match is only picked once nothing before it can still turn up.  called
+ * with the pool lock held while workers are running */
+void editorSearchResolve() {
+    struct editorSearch *S = &E.search;
+    struct searchScan *sc = S->scan;
+    if(sc == NULL || S->job != -1 || sc->njobs == 0) return;
+
+    for(int k = 0; k < sc->njobs; k++) {
+        struct searchJob *job = &sc->jobs[sc->order[k]];
+        if(!job->done) return;
+        for(int i = 0; i < job->found.n; i++) {
+            if(k == 0 && job->found.m[i].line < S->origin) continue;
+            editorSearchSelect(sc->order[k], i);
+            return;
+        }
+    }
+    if(sc->jobs[sc->order[0]].found.n) editorSearchSelect(sc->order[0], 0);
+}
+
+void editorSearchStep(int dir) {
+    struct editorSearch *S = &E.search;
+    struct searchScan *sc = S->scan;
+    if(sc == NULL || S->job == -1) return;
+
+    pthread_mutex_lock(&S->pool.lock);
+    int j = S->job;
+    int i = S->idx + dir;
+    while(1) {
+        struct searchJob *job = &sc->jobs[j];
+        if(job->done && i >= 0 && i < job->found.n) break;
+        j = (j + dir + sc->njobs) % sc->njobs;
+        i = dir > 0 ? 0 : sc->jobs[j].found.n - 1;
+    }
+    editorSearchSelect(j, i);
+    pthread_mutex_unlock(&S->pool.lock);
+}
+
+/* called from the event loop when the wake pipe fires */
+int editorSearchPoll() {
+    struct editorSearch *S = &E.search;
+    if(S->scan == NULL) return 0;
+
+    pthread_mutex_lock(&S->pool.lock);
+    S->pool.woken = 0;
+    int changed = S->scan->finished != S->seen;
+    S->seen = S->scan->finished;
+    if(changed) {
+        editorSearchResolve();
+        S->gen++;
+    }
+    pthread_mutex_unlock(&S->pool.lock);
+    return changed;
+}
+
+/* enter takes the match the search would land on, so wait for it */
+void editorSearchWait() {
+    struct editorSearch *S = &E.search;
+    if(S->scan == NULL) return;
+
+    pthread_mutex_lock(&S->pool.lock);
+    editorSearchResolve();
+    while(S->job == -1 && S->scan->finished < S->scan->njobs) {
+        pthread_cond_wait(&S->pool.posted, &S->pool.lock);
+        editorSearchResolve();
+    }
+    pthread_mutex_unlock(&S->pool.lock);
+}
+
+void editorSearchUpdate(const char *query) {
+    struct editorSearch *S = &E.search;
+    int qlen = strlen(query);
+    if(S->query && !strcmp(S->query, query)) return;
+
+    int prev = S->query ? (int)strlen(S->query) : -1;
+    struct searchScan *sc = S->scan;
+    editorSearchRestoreHighlight();
+
+    /* a pattern that doesn't compile yet, often one still being typed,
+     * just finds nothing */
+    S->err = NULL;
+    searchPattern *pat = qlen ? searchCompile(query, qlen, &S->err) : NULL;
+
+    if(pat && sc && sc->finished == sc->njobs && sc->pat->literal && pat->literal &&
+            prev >= 0 && prev <= qlen && !strncmp(S->query, query, prev)) {
+        reScratch rs = RESCRATCH_INIT;
+        sc->matches = 0;
+        for(int j = 0; j < sc->njobs; j++) {
+            searchListRefine(&sc->jobs[j].found, pat, &rs);
+            sc->matches += sc->jobs[j].found.n;
+        }
+        reScratchFree(&rs);
+        searchPatternFree(sc->pat);
+        sc->pat = pat;
+        S->job = -1;
+        S->gen++;
+    } else {
+        editorSearchCancel();
+        if(pat) editorSearchStart(pat);
+    }
+
+    free(S->query);
+    S->query = qlen ? strdup(query) : NULL;
+
+    if(S->scan) {
+        pthread_mutex_lock(&S->pool.lock);
+        editorSearchResolve();
+        pthread_mutex_unlock(&S->pool.lock);
+    }
+}
+
+void editorSearchReset() {
+    struct editorSearch *S = &E.search;
+    editorSearchRestoreHighlight();
+    editorSearchCancel();
+    free(S->query);
+    S->query = NULL;
+    S->err = NULL;
+}
+
+void editorFindCallback(char *query, int key) {
+    long long t = benchStart();
+    if(key == '\r') {
+        editorSearchWait();
+        if(E.search.err) editorSetStatusMessage("Can't search for that, it has %s", E.search.err);
+        editorSearchReset();
+    } else if(key == '\x1b') {
+        editorSearchReset();
+    } else if(key == ARROW_RIGHT || key == ARROW_DOWN) {
+        editorSearchStep(1);
+    } else if(key == ARROW_LEFT || key == ARROW_UP) {
+        editorSearchStep(-1);
+    } else {
+        editorSearchUpdate(query);
+        /* timed up to the first match on screen */
+        if(E.bench.on) editorSearchWait();
+    }
+    benchRecord(BENCH_FIND, t);
+}
+
+void editorFind() {
+    E.search.origin = E.cy;
+    int saved_cx = E.cx;
+    int saved_cy = E.cy;
+    int saved_coloff = E.coloff;
+    int saved_rowoff = E.rowoff;
+
+
+    char *query = editorPrompt("Searching '%s'", editorFindCallback);
+
+    if(query) {
+        free(query);
+    } else {
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.coloff = saved_coloff;
+        E.rowoff = saved_rowoff;
+    }
+}
+
+/* :g/pat/d deletes every line holding pat and :v/pat/d every line that
+ * doesn't.  the matching lines come from the same block scan the search
+ * uses, and whole runs go out bottom up through editorDelRows so the
+ * line numbers still to come stay valid */
+void editorGlobal(char *command) {
+    int invert = command[0] == 'v';
+    char *pat = command + 2;
+    char *end = strchr(pat, '/');
+    if(command[1] != '/' || end == NULL || end == pat || strcmp(end + 1, "d") != 0) {
+        editorSetStatusMessage("Usage: :g/pattern/d or :v/pattern/d");
+        return;
+    }
+    const char *err = NULL;
+    searchPattern *sp = searchCompile(pat, end - pat, &err);
+    if(sp == NULL) {
+        editorSetStatusMessage("Can't match that, it has %s", err);
+        return;
+    }
+
+    struct searchList found = {NULL, 0, 0};
+    reScratch rs = RESCRATCH_INIT;
+    erow *e = NULL;
+    if(E.rope->count) {
+        int slot, off;
+        ropeNode *leaf = ropeLeafFor(0, &slot, &off);
+        e = leaf->u.rows[slot];
+    }
+    for(int line = 0; e; e = ropeEntryNext(e)) {
+        searchSegment seg = {e->chars, e->size, line, e->mapped};
+        searchBlock(&found, &seg, sp, 0, &rs);
+        line += e->lines;
+    }
+    reScratchFree(&rs);
+    searchPatternFree(sp);
+
+    int deleted = 0;
+    int next = E.numrows;
+    for(int j = found.n - 1; j >= -1; j--) {
+        int line = j >= 0 ? found.m[j].line : -1;
+        if(invert) {
+            if(next - line - 1 > 0) editorDelRows(line + 1, next - line - 1);
+            deleted += next - line - 1;
+            next = line;
+        } else if(j >= 0) {
+            int first = j;
+            while(first > 0 && found.m[first - 1].line == found.m[first].line - 1) first--;
+            int n = line - found.m[first].line + 1;
+            editorDelRows(found.m[first].line, n);
+            deleted += n;
+            j = first;
+        }
+    }
+    free(found.m);
+
+    if(E.cy > E.numrows) E.cy = E.numrows;
+    erow *row = editorRowAt(E.cy);
+    int rowlen = row ? row->size : 0;
+    if(E.cx > rowlen) E.cx = rowlen;
+    editorSetStatusMessage("Voided from space-time %d lines!", deleted);
+}
+
+/* :s/pat/rep/[g] on the cursor line, :%s/pat/rep/[g] on every line.  all
+ * the matches are found first, then each row they hit is rewritten once
+ * from its first match to its last, and the lot goes in the journal as a
+ * single record.  in the replacement & is the whole match and a backslash
+ * takes the next character as it is */
+void editorSubstitute(char *command) {
+    int whole = command[0] == '%';
+    char *pat = command + whole + 2;
+    char *end = pat;
+    while(*end && *end != '/') end += end[0] == '\\' && end[1] ? 2 : 1;
+    if(command[whole + 1] != '/' || *end == '\0' || end == pat) {
+        editorSetStatusMessage("Usage: :s/pattern/replacement/[g] or :%%s/...");
+        return;
+    }
+
+    /* the replacement is cooked once, with the places & stood in */
+    char *in = end + 1;
+    int inlen = strlen(in);
+    char *rep = malloc(inlen + 1);
+    int *amp = malloc(sizeof(int) * (inlen + 1));
+    if(rep == NULL || amp == NULL) die("malloc");
+    int replen = 0, namp = 0;
+    while(*in && *in != '/') {
+        if(in[0] == '\\' && in[1]) {
+            rep[replen++] = in[1] == 't' ? '\t' : in[1];
+            in += 2;
         } else {
-            row->render[idx++] = row->chars[j];
+            if(*in == '&') amp[namp++] = replen;
+            else rep[replen++] = *in;
+            in++;
         }
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    int global = 0;
+    if(*in == '/') in++;
+    if(*in == 'g') {
+        global = 1;
+        in++;
+    }
+    if(*in) {
+        free(rep);
+        free(amp);
+        editorSetStatusMessage("Usage: :s/pattern/replacement/[g] or :%%s/...");
+        return;
+    }
+
+    const char *err = NULL;
+    searchPattern *sp = searchCompile(pat, end - pat, &err);
+    if(sp == NULL) {
+        free(rep);
+        free(amp);
+        editorSetStatusMessage("Can't match that, it has %s", err);
+        return;
+    }
+
+    struct searchList found = {NULL, 0, 0};
+    reScratch rs = RESCRATCH_INIT;
+    if(whole) {
+        erow *e = NULL;
+        if(E.rope->count) {
+            int slot, off;
+            ropeNode *leaf = ropeLeafFor(0, &slot, &off);
+            e = leaf->u.rows[slot];
+        }
+        for(int line = 0; e; e = ropeEntryNext(e)) {
+            searchSegment seg = {e->chars, e->size, line, e->mapped};
+            searchBlock(&found, &seg, sp, global, &rs);
+            line += e->lines;
+        }
+    } else if(E.cy < E.numrows) {
+        erow *row = editorRowAt(E.cy);
+        searchSegment seg = {row->chars, row->size, E.cy, 0};
+        searchBlock(&found, &seg, sp, global, &rs);
+    }
+    reScratchFree(&rs);
+    searchPatternFree(sp);
+
+    /* old and new stretch of every row, laid out the way the journal
+     * keeps them */
+    char *buf = NULL;
+    size_t used = 0, cap = 0;
+    int rows = 0;
+    for(int j = 0; j < found.n; ) {
+        int k = j;
+        while(k + 1 < found.n && found.m[k + 1].line == found.m[j].line) k++;
+        struct searchMatch *a = &found.m[j], *b = &found.m[k];
+        const char *from = a->p;
+        const char *to = b->p + b->len;
+
+        size_t most = sizeof(undoSubst) + 2 * (to - from) + (size_t)(k - j + 1) * replen;
+        for(int i = j; namp && i <= k; i++) most += (size_t)namp * found.m[i].len;
+        if(used + most > cap) {
+            cap = (used + most) * 2;
+            buf = realloc(buf, cap);
+            if(buf == NULL) die("realloc");
+        }
+        undoSubst s = {a->line, a->col, to - from, 0};
+        char *out = buf + used + sizeof(s);
+        memcpy(out, from, s.oldlen);
+        out += s.oldlen;
+        char *start = out;
+        for(int i = j; i <= k; i++) {
+            struct searchMatch *m = &found.m[i];
+            if(i > j) {
+                const char *gap = found.m[i - 1].p + found.m[i - 1].len;
+                memcpy(out, gap, m->p - gap);
+                out += m->p - gap;
+            }
+            int at = 0;
+            for(int q = 0; q < namp; q++) {
+                memcpy(out, rep + at, amp[q] - at);
+                out += amp[q] - at;
+                memcpy(out, m->p, m->len);
+                out += m->len;
+                at = amp[q];
+            }
+            memcpy(out, rep + at, replen - at);
+            out += replen - at;
+        }
+        s.newlen = out - start;
+        memcpy(buf + used, &s, sizeof(s));
+        used = out - buf;
+        rows++;
+        j = k + 1;
+    }
+    int count = found.n;
+    free(found.m);
+    free(rep);
+    free(amp);
+
+    if(rows == 0) {
+        free(buf);
+        editorSetStatusMessage("Nothing there to swap out");
+        return;
+    }
+    if(used > INT_MAX - 64) {
+        free(buf);
+        editorSetStatusMessage("That is too many swaps for one go");
+        return;
+    }
+
+    if(!E.undo.suspended) {
+        editorUndoBegin();
+        undoRec *r = undoNew(UNDO_SUBST, ((undoSubst *)buf)->line, rows, used);
+        memcpy(r + 1, buf, used);
+        undoTrim();
+    }
+
+    E.undo.suspended++;
+    int last = 0;
+    for(char *p = buf; p < buf + used; ) {
+        undoSubst s;
+        memcpy(&s, p, sizeof(s));
+        char *new = p + sizeof(s) + s.oldlen;
+        editorRowReplace(editorRowAt(s.line), s.col, s.oldlen, new, s.newlen);
+        last = s.line;
+        p = new + s.newlen;
+    }
+    E.undo.suspended--;
+    free(buf);
+
+    E.cy = last;
+    E.cx = 0;
+    editorSetStatusMessage("Swapped %d for something better on %d lines", count, rows);
+}
+
+/*** BUFFERS ***/
+
+void editorBufferPark(struct editorBuffer *b) {
+    b->cx = E.cx;
+    b->cy = E.cy;
+    b->rx = E.rx;
+    b->rowoff = E.rowoff;
+    b->coloff = E.coloff;
+    b->wrapoff = E.wrapoff;
+    b->numrows = E.numrows;
+    b->rope = E.rope;
+    b->map = E.map;
+    b->mapsize = E.mapsize;
+    b->mapfd = E.mapfd;
+    b->mapline = E.mapline;
+    b->indexer = E.indexer;
+    b->decoder = E.decoder;
+    b->codec = E.codec;
+    b->crlf = E.crlf;
+    b->save = E.save;
+    b->swap = E.swap;
+    b->undo = E.undo;
+    b->dirty = E.dirty;
+    b->filename = E.filename;
+    b->syntax = E.syntax;
+    b->hl_gen = E.hl_gen;
+    b->hl_frontier = E.hl_frontier;
+    b->edits = E.edits;
+    b->follow = E.follow;
+}
+
+void editorBufferLoad(struct editorBuffer *b) {
+    E.cx = b->cx;
+    E.cy = b->cy;
+    E.rx = b->rx;
+    E.rowoff = b->rowoff;
+    E.coloff = b->coloff;
+    E.wrapoff = b->wrapoff;
+    E.numrows = b->numrows;
+    E.rope = b->rope;
+    E.map = b->map;
+    E.mapsize = b->mapsize;
+    E.mapfd = b->mapfd;
+    E.mapline = b->mapline;
+    E.indexer = b->indexer;
+    E.decoder = b->decoder;
+    E.codec = b->codec;
+    E.crlf = b->crlf;
+    E.save = b->save;
+    E.swap = b->swap;
+    E.undo = b->undo;
+    E.dirty = b->dirty;
+    E.filename = b->filename;
+    E.syntax = b->syntax;
+    E.hl_gen = b->hl_gen;
+    E.hl_frontier = b->hl_frontier;
+    E.edits = b->edits;
+    E.follow = b->follow;
+}
+
+/* the fields of a buffer that was never opened; the parked copy still owns
+ * whatever these pointed at */
+void editorBufferBlank() {
+    E.cx = 0;
+    E.cy = 0;
+    E.rx = 0;
+    E.rowoff = 0;
+    E.coloff = 0;
+    E.wrapoff = 0;
+    E.numrows = 0;
+    E.rope = ropeNewNode(1);
+    E.map = NULL;
+    E.mapsize = 0;
+    E.mapfd = -1;
+    E.mapline = 0;
+    E.indexer = NULL;
+    E.decoder = NULL;
+    E.codec = NULL;
+    E.crlf = 0;
+    E.save = calloc(1, sizeof(struct saveJob));
+    if(E.save == NULL) die("calloc");
+    memset(&E.swap, 0, sizeof(E.swap));
+    E.swap.fd = -1;
+    memset(&E.undo, 0, sizeof(E.undo));
+    E.undo.spillfd = -1;
+    E.dirty = 0;
+    E.filename = NULL;
+    E.syntax = NULL;
+    E.hl_gen = 1;
+    E.hl_frontier = 0;
+    E.edits = 0;
+    memset(&E.follow, 0, sizeof(E.follow));
+    E.follow.fd = E.follow.wd = E.follow.dwd = -1;
+    E.follow.nl = 1;
+}
+
+struct editorBuffer *editorBufferAdd() {
+    struct editorBuffers *bl = &E.bufs;
+    if(bl->n == bl->cap) {
+        bl->cap = bl->cap ? bl->cap * 2 : 8;
+        bl->list = realloc(bl->list, sizeof(struct editorBuffer) * bl->cap);
+        if(bl->list == NULL) die("realloc");
+    }
+    return &bl->list[bl->n++];
+}
+
+/* a finished save is only reaped for the buffer in E, and search results
+ * point into the rows, so both are settled before E is parked */
+void editorBufferLeave() {
+    editorSearchReset();
+    editorSaveWait();
+    if(E.swap.due) editorSwapFlush();
+    editorBufferPark(&E.bufs.list[E.bufs.cur]);
+}
 
-    editorUpdateSyntax(row);
+void editorBufferSwitch(int k) {
+    if(k == E.bufs.cur) return;
+    editorBufferLeave();
+    editorBufferLoad(&E.bufs.list[k]);
+    E.bufs.cur = k;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.numrows) return;
+/* the same file is only ever held once: opening it again goes to the
+ * buffer that already has it, and its rows and highlighting with it */
+int editorBufferFind(const char *filename) {
+    struct stat want, st;
+    if(stat(filename, &want) == -1) return -1;
+
+    struct editorBuffers *bl = &E.bufs;
+    for(int k = 0; k < bl->n; k++) {
+        char *name = k == bl->cur ? E.filename : bl->list[k].filename;
+        if(name && stat(name, &st) == 0 &&
+                st.st_dev == want.st_dev && st.st_ino == want.st_ino)
+            return k;
+    }
+    return -1;
+}
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-    for(int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+void editorBufferEdit(char *filename) {
+    int k = editorBufferFind(filename);
+    if(k == E.bufs.cur) {
+        editorSetStatusMessage("You're already looking at it");
+        return;
+    }
+    if(k >= 0) {
+        editorBufferSwitch(k);
+        editorSetStatusMessage("Back to %s", E.filename);
+        return;
+    }
 
-    E.row[at].idx = at;
+    int exists = access(filename, F_OK) == 0;
+    if(exists && access(filename, R_OK) == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        return;
+    }
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    editorBufferLeave();
+    editorBufferAdd();
+    E.bufs.cur = E.bufs.n - 1;
+    editorBufferBlank();
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    editorUpdateRow(&E.row[at]);
+    if(exists) {
+        editorOpen(filename);
+    } else {
+        E.filename = strdup(filename);
+        E.codec = editorCodecByName(filename);
+        editorSelectSyntaxHighlight();
+        editorSwapPath();
+        editorSetStatusMessage("%s is brand new", filename);
+    }
+}
 
-    E.numrows++;
-    E.dirty++;
+void editorBufferCycle(int dir) {
+    struct editorBuffers *bl = &E.bufs;
+    if(bl->n < 2) {
+        editorSetStatusMessage("There is only this one buffer");
+        return;
+    }
+    editorBufferSwitch((bl->cur + dir + bl->n) % bl->n);
+    editorSetStatusMessage("[%d/%d] %s", bl->cur + 1, bl->n,
+            E.filename ? E.filename : "[New File]");
 }
 
-void editorYankRow(int at, int lines) {
-    if (E.cprow) {
-        for (int i = 0; i < E.cprow[0].lines; i++) {
-            free(E.cprow[i].chars);
-        }
-        free(E.cprow);
-        E.cprow = NULL;
+void editorBufferList() {
+    struct editorBuffers *bl = &E.bufs;
+    char msg[sizeof(E.statusmsg)];
+    int len = 0;
+    for(int k = 0; k < bl->n && len < (int)sizeof(msg); k++) {
+        char *name = k == bl->cur ? E.filename : bl->list[k].filename;
+        int dirty = k == bl->cur ? E.dirty : bl->list[k].dirty;
+        len += snprintf(msg + len, sizeof(msg) - len, k == bl->cur ? "%s[%d %s%s]" : "%s%d %s%s",
+                k ? " | " : "", k + 1, name ? name : "[New File]", dirty ? "*" : "");
     }
+    editorSetStatusMessage("%s", msg);
+}
 
-    E.cprow = malloc(sizeof(copyrow) * lines);
+/* the first buffer other than the current one with unsaved changes */
+int editorBufferDirty() {
+    struct editorBuffers *bl = &E.bufs;
+    for(int k = 0; k < bl->n; k++)
+        if(k != bl->cur && bl->list[k].dirty) return k;
+    return -1;
+}
 
-    for(int i = 0; i < lines; i++) {
-        E.cprow[i].size = E.row[at + i].size;
-        E.cprow[i].chars = malloc(E.row[at + i].size);
-        memcpy(E.cprow[i].chars, E.row[at + i].chars, E.row[at + i].size);
+/* on the way out every buffer drops its swap file */
+void editorBufferCloseAll() {
+    struct editorBuffers *bl = &E.bufs;
+    editorSaveWait();
+    editorBufferPark(&bl->list[bl->cur]);
+    for(int k = 0; k < bl->n; k++) {
+        editorBufferLoad(&bl->list[k]);
+        editorSwapReset();
     }
-    E.cprow[0].lines = lines;
-    if (lines == 1)
-        editorSetStatusMessage("Yanked that %d line!", lines);
-    else if (lines == 69) 
-        editorSetStatusMessage("Yanked those nice %d lines!", lines);
-    else 
-        editorSetStatusMessage("Yanked those %d lines!", lines);
 }
 
-void editorDelYankRow(int at, int lines) {
-    editorYankRow(at, lines);
+/*** WINDOWS ***/
 
-    for(int i = 0; i < lines; i++) {
-        editorDelRow(at);
-    }  
-    if (lines == 1)
-        editorSetStatusMessage("Voided from space-time %d line!", lines);
-    else if (lines == 69) 
-        editorSetStatusMessage("Voided from space-time %d lines, not nice!", lines);
-    else 
-        editorSetStatusMessage("Voided from space-time %d lines!", lines);
+/* windows tile the screen above the message bar.  like buffers, the
+ * active window keeps its view in E, screenrows x screencols included, and
+ * the others park theirs here; windows on one buffer share its rows and
+ * highlighting, so two views of a huge file cost one copy of it */
+
+editorWindow *editorWindowCur() {
+    return E.wins.list[E.wins.cur];
 }
 
-void editorPasteRows() {
-    if(E.cprow == NULL) editorSetStatusMessage("Nothing in Yank Buffer");
-    else {
-        for(int i = 0; i < E.cprow[0].lines; i++) {
-            editorInsertRow(E.cy + 1 + i, E.cprow[i].chars, E.cprow[i].size);
-        }
+void editorWindowPark(editorWindow *w) {
+    w->buf = E.bufs.cur;
+    w->cx = E.cx;
+    w->cy = E.cy;
+    w->rx = E.rx;
+    w->rowoff = E.rowoff;
+    w->coloff = E.coloff;
+    w->wrapoff = E.wrapoff;
+}
 
-        for(int i = 0; i < E.cprow[0].lines; i++) {
-            editorMoveCursor(ARROW_DOWN);
-        }
-        
+void editorWindowLoad(editorWindow *w) {
+    E.cx = w->cx;
+    E.cy = w->cy;
+    E.rx = w->rx;
+    E.rowoff = w->rowoff;
+    E.coloff = w->coloff;
+    E.wrapoff = w->wrapoff;
+    E.screenrows = w->rows;
+    E.screencols = w->cols;
+}
 
-        int lines = E.cprow[0].lines;
+layoutNode *layoutLeaf(editorWindow *w) {
+    layoutNode *n = calloc(1, sizeof(layoutNode));
+    if(n == NULL) die("calloc");
+    n->win = w;
+    w->node = n;
+    return n;
+}
 
-        if (lines == 1)
-            editorSetStatusMessage("Pasted with magic %d line!", lines);
-        else if (lines == 69) 
-            editorSetStatusMessage("Pasted with nice magic %d lines!", lines);
-        else 
-            editorSetStatusMessage("Pasted with magic %d lines!", lines);
+void layoutPlace(layoutNode *n, int top, int left, int height, int width) {
+    n->top = top;
+    n->left = left;
+    n->height = height;
+    n->width = width;
+    if(n->win) {
+        editorWindow *w = n->win;
+        w->top = top;
+        w->left = left;
+        w->rows = height > 1 ? height - 1 : 1;
+        w->cols = width > 0 ? width : 1;
+        return;
+    }
+    if(n->vertical) {
+        int a = (width - 1) / 2;
+        layoutPlace(n->kid[0], top, left, height, a);
+        layoutPlace(n->kid[1], top, left + a + 1, height, width - a - 1);
+    } else {
+        int a = height / 2;
+        layoutPlace(n->kid[0], top, left, a, width);
+        layoutPlace(n->kid[1], top + a, left, height - a, width);
     }
 }
 
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+/* the window list follows the layout, left to right and top to bottom */
+void layoutCollect(layoutNode *n) {
+    struct editorWindows *ws = &E.wins;
+    if(n->win == NULL) {
+        layoutCollect(n->kid[0]);
+        layoutCollect(n->kid[1]);
+        return;
+    }
+    if(ws->n == ws->cap) {
+        ws->cap = ws->cap ? ws->cap * 2 : 8;
+        ws->list = realloc(ws->list, sizeof(editorWindow *) * ws->cap);
+        if(ws->list == NULL) die("realloc");
+    }
+    ws->list[ws->n++] = n->win;
 }
 
-void editorDelRow(int at) {
-    if(at < 0 || at >= E.numrows) return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    for(int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
-    E.numrows--;
-    E.dirty++;
+void editorWindowsLayout() {
+    struct editorWindows *ws = &E.wins;
+    if(ws->root == NULL) return;
+    layoutPlace(ws->root, 0, 0, E.frame.rows - 1, E.frame.cols);
+    ws->layout++;
+    editorWindow *w = editorWindowCur();
+    E.screenrows = w->rows;
+    E.screencols = w->cols;
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
-    if(at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.dirty++;
+/* rebuilds the list after the tree changed and refocuses on w, whose view
+ * must already be in E */
+void editorWindowsRelist(editorWindow *w) {
+    struct editorWindows *ws = &E.wins;
+    ws->n = 0;
+    layoutCollect(ws->root);
+    for(int k = 0; k < ws->n; k++)
+        if(ws->list[k] == w) ws->cur = k;
+    editorWindowsLayout();
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
+void editorWindowsInit() {
+    struct editorWindows *ws = &E.wins;
+    editorWindow *w = calloc(1, sizeof(editorWindow));
+    if(w == NULL) die("calloc");
+    ws->root = layoutLeaf(w);
+    ws->n = 0;
+    layoutCollect(ws->root);
+    ws->cur = 0;
 }
 
-void editorRowDelChar(erow *row, int at) {
-    if(at < 0 || at >= row->size) return;
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+void editorWindowFocus(int k) {
+    struct editorWindows *ws = &E.wins;
+    if(k == ws->cur) return;
+    editorWindow *w = ws->list[k];
+    editorWindowPark(editorWindowCur());
+    if(w->buf != E.bufs.cur) editorBufferSwitch(w->buf);
+    ws->cur = k;
+    editorWindowLoad(w);
 }
 
-/*** EDITOR OPERATIONS ***/
-
-void editorInsertChar(int c) {
-    if(E.cy == E.numrows) {
-        editorInsertRow(E.numrows, "", 0);
+/* the new window opens on top of (or left of) the old one, on the same
+ * buffer at the same spot, and takes the focus */
+void editorWindowSplit(int vertical) {
+    editorWindow *w = editorWindowCur();
+    if(vertical ? w->cols < 3 : w->rows < 3) {
+        editorSetStatusMessage("No room left to split, get a bigger terminal");
+        return;
     }
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    E.cx++;
+    editorWindowPark(w);
+    editorWindow *nw = malloc(sizeof(editorWindow));
+    if(nw == NULL) die("malloc");
+    *nw = *w;
+    memset(&nw->stamp, 0, sizeof(nw->stamp));
+
+    layoutNode *n = w->node;
+    n->win = NULL;
+    n->vertical = vertical;
+    n->kid[0] = layoutLeaf(nw);
+    n->kid[1] = layoutLeaf(w);
+    n->kid[0]->parent = n->kid[1]->parent = n;
+    editorWindowsRelist(nw);
 }
 
-void editorInsertNewline() {
-    if(E.cx == 0) {
-        editorInsertRow(E.cy, "", 0);
+/* the sibling of a closed window takes over its parent's rectangle */
+void editorWindowRemove(editorWindow *w) {
+    layoutNode *leaf = w->node;
+    layoutNode *parent = leaf->parent;
+    layoutNode *sib = parent->kid[0] == leaf ? parent->kid[1] : parent->kid[0];
+
+    parent->vertical = sib->vertical;
+    parent->win = sib->win;
+    parent->kid[0] = sib->kid[0];
+    parent->kid[1] = sib->kid[1];
+    if(parent->win) {
+        parent->win->node = parent;
     } else {
-        erow *row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        parent->kid[0]->parent = parent->kid[1]->parent = parent;
     }
-    E.cy++;
-    E.cx = 0;
+    free(sib);
+    free(leaf);
+    free(w);
 }
 
-void editorDelChar() {
-    if(E.cy == E.numrows) return;
-    if(E.cx == 0 && E.cy == 0) return;
-
-    erow *row = &E.row[E.cy];
-    if(E.cx > 0) {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-    } else {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+void editorWindowClose() {
+    struct editorWindows *ws = &E.wins;
+    if(ws->n == 1) {
+        editorSetStatusMessage("That's the last window, :q if you mean it");
+        return;
     }
+    editorWindow *w = editorWindowCur();
+    editorWindowFocus(ws->cur + 1 < ws->n ? ws->cur + 1 : ws->cur - 1);
+    editorWindow *keep = editorWindowCur();
+    editorWindowRemove(w);
+    editorWindowsRelist(keep);
 }
 
+void editorWindowOnly() {
+    struct editorWindows *ws = &E.wins;
+    editorWindow *keep = editorWindowCur();
+    while(ws->n > 1) {
+        editorWindow *w = ws->list[ws->list[0] == keep ? 1 : 0];
+        editorWindowRemove(w);
+        editorWindowsRelist(keep);
+    }
+}
 
-/*** FILE I/O ***/
+/*** FOLLOW ***/
+
+/* :follow watches the file with inotify like tail -f.  what got appended
+ * is read from the last offset and hung after the last entry of the rope
+ * in one pass; the rows are already on disk, so nothing is journaled and
+ * the buffer does not turn dirty.  new rows are only marked stale, the
+ * highlighter gets to them once they show up on screen */
+
+/* a file that was moved away is waited for through a watch on its
+ * directory, which reports every name in there */
+int editorFollowMatch(struct editorFollow *F, char *filename,
+        struct inotify_event *ev) {
+    if(!F->on) return 0;
+    if(ev->wd == F->wd) return 1;
+    if(ev->wd != F->dwd || ev->len == 0) return 0;
+    char *slash = strrchr(filename, '/');
+    return strcmp(ev->name, slash ? slash + 1 : filename) == 0;
+}
 
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
-    int j;
-    for(j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
-    *buflen = totlen;
+struct editorFollow *editorFollowFor(struct inotify_event *ev) {
+    if(editorFollowMatch(&E.follow, E.filename, ev)) return &E.follow;
+    for(int k = 0; k < E.bufs.n; k++) {
+        struct editorBuffer *b = &E.bufs.list[k];
+        if(k != E.bufs.cur && editorFollowMatch(&b->follow, b->filename, ev))
+            return &b->follow;
+    }
+    return NULL;
+}
 
-    char *buf = malloc(totlen);
-    char *p = buf;
-    for(j = 0; j < E.numrows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+int editorFollowPoll() {
+    if(E.inotify == -1) return 0;
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    int any = 0;
+    ssize_t n;
+    while((n = read(E.inotify, u.buf, sizeof(u.buf))) > 0) {
+        for(char *p = u.buf; p < u.buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            struct editorFollow *F = editorFollowFor(ev);
+            if(F) {
+                F->pending = 1;
+                if(ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_CREATE | IN_MOVED_TO))
+                    F->moved = 1;
+                any = 1;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
     }
+    return any;
+}
 
-    return buf;
+void editorFollowStop() {
+    struct editorFollow *F = &E.follow;
+    if(F->wd != -1) inotify_rm_watch(E.inotify, F->wd);
+    if(F->dwd != -1) inotify_rm_watch(E.inotify, F->dwd);
+    if(F->fd != -1) close(F->fd);
+    F->fd = F->wd = F->dwd = -1;
+    F->on = F->pending = F->moved = 0;
 }
 
-int numPlaces(int n) {
-    int r = 1;
-    if(n < 0) n = (n == INT_MIN) ? INT_MAX : -n;
-    while(n > 9) {
-        n /= 10;
-        r++;
+/* starts reading the file at path afresh, off bytes in: after it was
+ * rotated, or after a save of ours replaced it */
+void editorFollowReopen(off_t off) {
+    struct editorFollow *F = &E.follow;
+    int cap = F->cap;
+    editorFollowStop();
+    F->on = 1;
+    F->cap = cap;
+    F->fd = open(E.filename, O_RDONLY);
+    if(F->fd == -1) {
+        char *dir = strdup(E.filename);
+        char *slash = strrchr(dir, '/');
+        if(slash) slash[slash == dir ? 1 : 0] = '\0';
+        F->dwd = inotify_add_watch(E.inotify, slash ? dir : ".", IN_CREATE | IN_MOVED_TO);
+        free(dir);
+        if(F->dwd == -1) {
+            editorFollowStop();
+            editorSetStatusMessage("%s is gone, stopped following it", E.filename);
+        } else {
+            editorSetStatusMessage("%s is gone, waiting for it to come back", E.filename);
+        }
+        return;
     }
-    return r;
+    F->wd = inotify_add_watch(E.inotify, E.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    F->off = off;
+    F->nl = 1;
+    F->pending = 1;
 }
 
-void editorOpen(char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
+void undoForget() {
+    E.undo.hc = NULL;
+    undoTruncate();
+    E.undo.pending = 1;
+}
 
-    editorSelectSyntaxHighlight();
+/* with a cap the oldest rows go; line numbers in the undo and swap
+ * journals would point at the wrong rows after that, so both start over */
+void editorFollowDrop(editorWindow *viewer, int n) {
+    int count;
+    erow **gone = ropeRemoveRange(0, n, &count);
+    for(int j = 0; j < count; j++) {
+        editorFreeRow(gone[j]);
+        editorRowDispose(gone[j]);
+    }
+    free(gone);
+    editorMapShift(0, -n);
+    E.numrows -= n;
+    editorSyntaxInvalidate(0);
+    undoForget();
+    if(E.swap.fd != -1 || E.swap.nops) editorSwapReset();
+    E.follow.dropped += n;
+
+    E.cy = E.cy > n ? E.cy - n : 0;
+    E.rowoff = E.rowoff > n ? E.rowoff - n : 0;
+    for(int k = 0; k < E.wins.n; k++) {
+        editorWindow *w = E.wins.list[k];
+        if(w == viewer || w->buf != E.bufs.cur) continue;
+        w->cy = w->cy > n ? w->cy - n : 0;
+        w->rowoff = w->rowoff > n ? w->rowoff - n : 0;
+    }
+}
 
-    FILE *fp = fopen(filename, "r");
-    if(!fp) die("fopen");
+int editorFollowIngest(editorWindow *viewer) {
+    struct editorFollow *F = &E.follow;
+    /* the search workers and marks point into the rows */
+    if(!F->on || !F->pending || E.search.scan) return 0;
+    F->pending = 0;
+    if(F->fd == -1) {
+        if(F->moved) editorFollowReopen(0);
+        if(F->fd == -1) return 0;
+    }
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while(linelen > 0 && (line[linelen - 1] == '\n' ||
-                    line[linelen - 1] == '\r'))
-            linelen--;
-        editorInsertRow(E.numrows, line, linelen);
+    struct stat st;
+    if(fstat(F->fd, &st) == -1) return 0;
+    if(st.st_size < F->off) {
+        editorSetStatusMessage("%s shrank, following it from the top", E.filename);
+        F->off = 0;
+        F->nl = 1;
     }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
-}
 
-void editorSave() {
-    if(E.filename == NULL) {
-        E.filename = editorPrompt("Save as '%s'", NULL);
-        if(E.filename == NULL) {
-            editorSetStatusMessage("Save aborted, didn't want to save huh?");
-            return;
-        }
-        editorSelectSyntaxHighlight();
+    int before = E.numrows;
+    erow *last = NULL;
+    if(E.rope->count) {
+        int slot, off;
+        ropeNode *leaf = ropeLeafFor(E.rope->count - 1, &slot, &off);
+        last = leaf->u.rows[slot];
     }
 
-    int len;
-    char *buf = editorRowsToString(&len);
-
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if(fd != -1) {
-        if(ftruncate(fd, len) != -1) {
-            if(write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+    char *buf = NULL;
+    if(F->off < st.st_size) {
+        buf = malloc(THOR_FOLLOW_CHUNK);
+        if(buf == NULL) die("malloc");
+    }
+    int merged = -1;
+    while(F->off < st.st_size) {
+        size_t want = st.st_size - F->off;
+        if(want > THOR_FOLLOW_CHUNK) want = THOR_FOLLOW_CHUNK;
+        ssize_t n = pread(F->fd, buf, want, F->off);
+        if(n == -1 && errno == EINTR) continue;
+        if(n <= 0) break;
+
+        for(char *p = buf; p < buf + n; ) {
+            char *nl = memchr(p, '\n', buf + n - p);
+            char *eol = nl ? nl : buf + n;
+            int len = eol - p;
+            if(nl && len > 0 && p[len - 1] == '\r') len--;
+
+            if(!F->nl && E.numrows) {
+                /* the last line was still being written last time */
+                erow *row = editorRowAt(E.numrows - 1);
+                char *line = malloc(row->size + len);
+                if(line == NULL) die("malloc");
+                memcpy(line, row->chars, row->size);
+                memcpy(line + row->size, p, len);
+                if(row->text) rowTextRelease(row->text);
+                editorRowSetText(row, line, row->size + len);
+                free(line);
+                editorRenderRow(row);
+                if(merged == -1) merged = E.numrows - 1;
+                last = row;
+            } else {
+                erow *row = editorRowNew();
+                editorRowSetText(row, p, len);
+                row->lines = 1;
+                if(last) ropeInsertEntry(last->leaf, ropeRowSlot(last) + 1, row);
+                else ropeInsert(0, row);
+                editorRenderRow(row);
+                last = row;
+                E.numrows++;
             }
+            F->nl = nl != NULL;
+            p = nl ? nl + 1 : buf + n;
         }
-        close(fd);
+        F->off += n;
     }
     free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
-}
-
-/*** FIND ***/
 
-void editorFindCallback(char *query, int key) {
-    static int last_match = -1;
-    static int direction = 1;
+    if(E.numrows != before || merged != -1) {
+        editorSyntaxInvalidate(merged != -1 ? merged : before);
+        E.edits++;
 
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
+        /* whoever sat on the last line rides along */
+        if(E.cy >= before - 1) E.cy = E.numrows - 1;
+        for(int k = 0; k < E.wins.n; k++) {
+            editorWindow *w = E.wins.list[k];
+            if(w != viewer && w->buf == E.bufs.cur && w->cy >= before - 1)
+                w->cy = E.numrows - 1;
+        }
 
-    if(saved_hl) {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
+        int over = F->cap ? E.numrows - F->cap : 0;
+        if(over > 0 && !(E.indexer && E.indexer->running) && E.search.scan == NULL)
+            editorFollowDrop(viewer, over);
     }
 
-    if(key == '\r' || key == '\x1b') {
-        last_match = -1;
-        direction = 1;
+    if(F->moved) editorFollowReopen(0);
+    return 1;
+}
+
+void editorFollowCommand(char *arg) {
+    struct editorFollow *F = &E.follow;
+    while(*arg == ' ') arg++;
+    if(*arg && !isdigit(*arg)) {
+        editorSetStatusMessage("Follow how many lines? \"%s\" is not a number", arg);
+        return;
+    }
+    if(F->on && *arg == '\0') {
+        editorFollowStop();
+        editorSetStatusMessage("No longer following %s", E.filename);
+        return;
+    }
+    if(E.filename == NULL) {
+        editorSetStatusMessage("Nothing to follow, this file has no name yet");
+        return;
+    }
+    if(E.codec) {
+        editorSetStatusMessage("Can't follow %s, %s does not do tail -f", E.filename, E.codec->name);
         return;
-    } else if(key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if(key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        last_match = -1;
-        direction = 1;
     }
 
-    if(last_match == -1) direction = 1;
-    int current = last_match;
-    int i;
-    for(i = 0; i < E.numrows; i++) {
-        current += direction;
-        if(current == -1) current = E.numrows - 1;
-        else if(current == E.numrows) current = 0;
-
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if(match) {
-            last_match = current;
-            E.cy = current;
-            E.cx = editorRowRxToCx(row, match - row->render);
-            E.rowoff = E.numrows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);            
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+    if(!F->on) {
+        if(E.inotify == -1) E.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(E.inotify == -1) {
+            editorSetStatusMessage("Can't follow: %s", strerror(errno));
+            return;
+        }
+        F->fd = open(E.filename, O_RDONLY);
+        if(F->fd != -1)
+            F->wd = inotify_add_watch(E.inotify, E.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+        if(F->fd == -1 || F->wd == -1) {
+            editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+            editorFollowStop();
+            return;
         }
+        F->on = 1;
     }
-}
-
-void editorFind() {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.coloff;
-    int saved_rowoff = E.rowoff;
-
-
-    char *query = editorPrompt("Searching '%s'", editorFindCallback);
+    F->cap = atoi(arg);
+    F->pending = 1;
 
-    if(query) {
-        free(query);
-    } else {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.coloff = saved_coloff;
-        E.rowoff = saved_rowoff;
-    }
+    /* like tail -f, start at the bottom */
+    editorFollowIngest(editorWindowCur());
+    E.cy = E.numrows ? E.numrows - 1 : 0;
+    E.cx = 0;
+    if(F->cap)
+        editorSetStatusMessage("Following %s, keeping the last %d lines", E.filename, F->cap);
+    else
+        editorSetStatusMessage("Following %s", E.filename);
 }
 
 /*** APPEND BUFFER ***/
 
-struct abuf {
-    char *b;
-    int len;
-};
-
-#define ABUF_INIT {NULL, 0}
+/* the buffer only ever grows, doubling when it runs out, and the frame
+ * buffer in E.out is kept between frames, so a steady state frame does no
+ * allocation at all */
+
+char *abReserve(struct abuf *ab, int len) {
+    if(ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap : ABUF_MIN;
+        while(cap < ab->len + len) cap *= 2;
+        char *new = realloc(ab->b, cap);
+        if(new == NULL) return NULL;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    char *p = &ab->b[ab->len];
+    ab->len += len;
+    return p;
+}
 
 void abAppend(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b, ab->len + len);
+    char *p = abReserve(ab, len);
+    E.stats.g[STAT_APPENDS].cur++;
 
-    if(new == NULL) return;
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
+    if(p == NULL) return;
+    memcpy(p, s, len);
+}
+
+void abReset(struct abuf *ab) {
+    ab->len = 0;
 }
 
 void abFree(struct abuf *ab) {
     free(ab->b);
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
 }
 
 /*** OUTPUT ***/
 
+/* with soft wrap on a row takes as many screen lines as its columns fill,
+ * at least one, and the view starts wrapoff lines into row rowoff.  only
+ * the rows between the top of the view and the cursor are ever laid out */
+
+int editorRowHeight(erow *row) {
+    return row && row->rsize ? (row->rsize - 1) / E.screencols + 1 : 1;
+}
+
+void editorScrollWrap() {
+    int line = E.rx / E.screencols;
+    E.wrapx = E.rx % E.screencols;
+    E.coloff = 0;
+
+    /* the cursor just past a row that fills its last line stays on it */
+    if(line && E.cy < E.numrows && line == editorRowHeight(editorRowAt(E.cy))) {
+        line--;
+        E.wrapx = E.screencols - 1;
+    }
+
+    if(E.cy < E.rowoff || (E.cy == E.rowoff && line < E.wrapoff)) {
+        E.rowoff = E.cy;
+        E.wrapoff = line;
+    }
+    if(E.cy - E.rowoff >= E.screenrows) {
+        E.rowoff = E.cy - E.screenrows + 1;
+        E.wrapoff = 0;
+    }
+
+    erow *row = editorRowAt(E.rowoff);
+    if(E.wrapoff >= editorRowHeight(row)) E.wrapoff = editorRowHeight(row) - 1;
+
+    int y = line - E.wrapoff;
+    for(int r = E.rowoff; r < E.cy; r++, row = editorRowNext(row))
+        y += editorRowHeight(row);
+
+    row = editorRowAt(E.rowoff);
+    while(y >= E.screenrows) {
+        int drop = y - E.screenrows + 1;
+        int h = editorRowHeight(row) - E.wrapoff;
+        if(E.rowoff < E.cy && h <= drop) {
+            E.rowoff++;
+            E.wrapoff = 0;
+            row = editorRowNext(row);
+            y -= h;
+        } else {
+            E.wrapoff += drop;
+            y -= drop;
+        }
+    }
+    E.wrapy = y;
+}
+
 void editorScroll() {
     E.rx = 0;
     if(E.cy < E.numrows) {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        E.rx = editorRowCxToRx(editorRowAt(E.cy), E.cx);
+    }
+
+    if(E.wrap) {
+        editorScrollWrap();
+        return;
     }
 
     if(E.cy < E.rowoff) {
@@ -845,186 +6484,180 @@ void editorScroll() {
         E.rowoff = E.cy - E.screenrows + 1;
     }
 
-    if(E.rx < E.coloff) {
-        E.coloff = E.cx;
+    if(E.rx < E.coloff) {
+        E.coloff = E.cx;
+    }
+    if(E.rx >= E.coloff + E.screencols) {
+        E.coloff = E.cx - E.screencols + 1;
+    }
+}
+
+/* drawing goes into E.frame, a grid of cells, and editorFlushFrame only
+ * sends the terminal the cells that differ from what it showed last time
+ * (kept in E.frame.shadow) */
+
+void editorFrameResize(int rows, int cols) {
+    struct editorFrame *f = &E.frame;
+    if(f->rows == rows && f->cols == cols) return;
+
+    free(f->cells);
+    free(f->shadow);
+    f->rows = rows;
+    f->cols = cols;
+    f->cells = malloc(sizeof(screenCell) * rows * cols);
+    f->shadow = malloc(sizeof(screenCell) * rows * cols);
+    if(f->cells == NULL || f->shadow == NULL) die("malloc");
+    f->valid = 0;
+    f->top = f->left = 0;
+    f->width = cols;
+}
+
+void editorFrameOrigin(int top, int left, int width) {
+    E.frame.top = top;
+    E.frame.left = left;
+    E.frame.width = width;
+}
+
+screenCell *editorFrameLine(int y) {
+    struct editorFrame *f = &E.frame;
+    return &f->cells[(f->top + y) * f->cols + f->left];
+}
+
+void editorFrameClearLine(int y, int attr) {
+    screenCell *line = editorFrameLine(y);
+    for(int x = 0; x < E.frame.width; x++) {
+        line[x].ch = ' ';
+        line[x].fg = 0;
+        line[x].bg = 0;
+        line[x].attr = attr;
+    }
+}
+
+int editorFramePut(int y, int x, const char *s, int len, int fg, int attr) {
+    screenCell *line = editorFrameLine(y);
+    if(len > E.frame.width - x) len = E.frame.width - x;
+    for(int j = 0; j < len; j++) {
+        line[x + j].ch = s[j];
+        line[x + j].fg = fg;
+        line[x + j].bg = 0;
+        line[x + j].attr = attr;
+    }
+    return x + (len > 0 ? len : 0);
+}
+
+void editorDrawWelcome(int y, const char *text, const char *hi, int hifg) {
+    int textlen = strlen(text);
+    int hilen = hi ? strlen(hi) : 0;
+    int padding = (E.screencols - textlen - hilen) / 2;
+    int x = 0;
+    if(padding > 0) x = editorFramePut(y, 0, "~", 1, 94, 0);
+    if(padding > x) x = padding;
+    x = editorFramePut(y, x, text, textlen, 0, 0);
+    if(hi) editorFramePut(y, x, hi, hilen, hifg, 0);
+}
+
+void editorDrawRow(int y, erow *row, int filerow, int col) {
+    char *c;
+    unsigned char *hl;
+    int len = editorRowView(row, col, E.screencols, &c, &hl);
+
+    int mfrom = 0, mto = 0;
+    if(filerow == E.search.hl_line) {
+        mfrom = E.search.hl_rx - col;
+        mto = mfrom + E.search.hl_len;
+    }
+
+    screenCell *cell = editorFrameLine(y);
+    int j;
+    for(j = 0; j < len; j++) {
+        int h = (j >= mfrom && j < mto) ? HL_MATCH : hl[j];
+        const struct editorStyle *st = &syntaxStyles[h < (int)SYNTAX_STYLES ? h : HL_NORMAL];
+        if(iscntrl(c[j])) {
+            cell[j].ch = (c[j] <= 26) ? '@' : '?';
+            cell[j].attr = CELL_REVERSE;
+        } else {
+            cell[j].ch = c[j];
+        }
+        cell[j].fg = st->fg;
+        cell[j].bg = st->bg;
     }
-    if(E.rx >= E.coloff + E.screencols) {
-        E.coloff = E.cx - E.screencols + 1;
+
+    /* while searching every match in view is marked, not just the one
+     * the cursor went to */
+    struct searchMatch *m;
+    int n = E.search.draw ? editorSearchLine(filerow, &m) : 0;
+    for(int k = 0; k < n; k++) {
+        int from = editorRowCxToRx(row, m[k].col) - col;
+        int to = editorRowCxToRx(row, m[k].col + m[k].len) - col;
+        if(from < 0) from = 0;
+        if(to > len) to = len;
+        for(j = from; j < to; j++) {
+            cell[j].fg = 30;
+            cell[j].bg = 43;
+        }
     }
 }
 
-void editorDrawRows(struct abuf *ab) {
-    if(E.mode != INSERT)
-        abAppend(ab, "\x1b[1 q", 5);    
-    else 
-        abAppend(ab, "\x1b[5 q", 5);
-
+void editorDrawRows() {
     int y;
+    int filerow = E.rowoff;
+    int sub = E.wrap ? E.wrapoff : 0;
+    erow *row = NULL;
     for(y = 0; y < E.screenrows; y++) {
-        int filerow = y + E.rowoff;
+        editorFrameClearLine(y, 0);
         if(filerow >= E.numrows) {
-            if(E.numrows == 0 && y == E.screenrows / 3) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        "THOR - The Text EdiTHOR");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 2) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        "version \x1b[95m%s\x1b[m", THOR_VERSION);
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen + 10) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 3) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        "made by \x1b[92mOrangeXarot\x1b[m");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen +10) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 5) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        ":help     prints help commands");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 6) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        ":q                  exits thor");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 7) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        ":w              saves the file");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            
-            } else if(E.numrows == 0 && y == (E.screenrows / 3) + 8) {
-                char welcome [80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        ":creds  prints all the credits");
-                if(welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if(padding) {
-                    abAppend(ab, "\x1b[94m", 5);
-                    abAppend(ab, "~", 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    padding--;
-                }
-                while(padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-
-
-
-            
+            int w = y - E.screenrows / 3;
+            if(E.numrows == 0 && w == 0) {
+                editorDrawWelcome(y, "THOR - The Text EdiTHOR", NULL, 0);
+            } else if(E.numrows == 0 && w == 2) {
+                editorDrawWelcome(y, "version ", THOR_VERSION, 95);
+            } else if(E.numrows == 0 && w == 3) {
+                editorDrawWelcome(y, "made by ", "OrangeXarot", 92);
+            } else if(E.numrows == 0 && w == 5) {
+                editorDrawWelcome(y, ":help     prints help commands", NULL, 0);
+            } else if(E.numrows == 0 && w == 6) {
+                editorDrawWelcome(y, ":q                  exits thor", NULL, 0);
+            } else if(E.numrows == 0 && w == 7) {
+                editorDrawWelcome(y, ":w              saves the file", NULL, 0);
+            } else if(E.numrows == 0 && w == 8) {
+                editorDrawWelcome(y, ":creds  prints all the credits", NULL, 0);
             } else {
-                abAppend(ab, "\x1b[94m", 5);
-                abAppend(ab, "~", 1);
-                abAppend(ab, "\x1b[m", 3);
+                editorFramePut(y, 0, "~", 1, 94, 0);
             }
         } else {
-            int len = E.row[filerow].rsize - E.coloff;
-            if(len < 0) len = 0;
-            if(len > E.screencols) len = E.screencols;
-            char *c = &E.row[filerow].render[E.coloff];
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
-            int current_color = -1;
-            int j;
-            for(j = 0; j < len; j++) {
-                if(iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if(current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                } else if(hl[j] == HL_NORMAL) {
-                    if(current_color != -1) {
-                        abAppend(ab, "\x1b[39m", 5);
-                        abAppend(ab, "\x1b[49m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, &c[j], 1);
-                } else {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if(color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen;
-                        if (color == 43) clen = snprintf(buf, sizeof(buf), "\x1b[30;%dm", color);
-                        else clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[j], 1);
-
-                }
+            if(row == NULL) row = editorRowAt(filerow);
+            editorHighlightRow(row, filerow);
+            if(!E.wrap) {
+                editorDrawRow(y, row, filerow, E.coloff);
+            } else {
+                editorDrawRow(y, row, filerow, sub * E.screencols);
+                if(++sub < editorRowHeight(row)) continue;
+                sub = 0;
             }
-            abAppend(ab, "\x1b[39m", 5);
-            abAppend(ab, "\x1b[49m", 5);
+            filerow++;
+            row = NULL;
         }
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
     }
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar() {
     char status[80], rstatus[80];
     int len = snprintf(status, sizeof(status), 
-            " %.20s%s - %d lines", 
-            E.filename ? E.filename : "[New File]", E.dirty ? "*" : "", E.numrows); 
+            " %.20s%s - %d%s lines", 
+            E.filename ? E.filename : "[New File]", E.dirty ? "*" : "", E.numrows,
+            (E.indexer && E.indexer->running) ||
+            (E.decoder && E.decoder->running) ? "+" : ""); 
+    if(E.bufs.n > 1 && len < (int)sizeof(status)) {
+        len += snprintf(status + len, sizeof(status) - len, " - buffer %d/%d",
+                E.bufs.cur + 1, E.bufs.n);
+        if(len >= (int)sizeof(status)) len = sizeof(status) - 1;
+    }
+    if(E.save->running && len < (int)sizeof(status)) {
+        size_t done = __atomic_load_n(&E.save->written, __ATOMIC_RELAXED);
+        len += snprintf(status + len, sizeof(status) - len, " - saving %d%%",
+                E.save->total ? (int)(100.0 * done / E.save->total) : 100);
+        if(len >= (int)sizeof(status)) len = sizeof(status) - 1;
+    }
 
     int perc;
     if(E.numrows <= E.screenrows) perc = 100;
@@ -1033,66 +6666,319 @@ void editorDrawStatusBar(struct abuf *ab) {
     if(perc > 100) perc = 100;
     else if(perc < 0) perc = 100;
 
+    char found[32] = "";
+    struct searchScan *sc = E.search.scan;
+    if(sc) {
+        pthread_mutex_lock(&E.search.pool.lock);
+        snprintf(found, sizeof(found), "%d%s matches | ", sc->matches,
+                sc->finished < sc->njobs ? "+" : "");
+        pthread_mutex_unlock(&E.search.pool.lock);
+    }
+
     int rlen;
     if (E.filename) {
-        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %s | %d%% %d,%d ", 
-            E.user, E.syntax ? E.syntax->filetype : "filetype not detected", perc, E.cy + 1, E.cx + 1);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %s | %d%% %d,%d ", 
+            found, E.user, E.syntax ? E.syntax->filetype : "filetype not detected", perc, E.cy + 1, E.cx + 1);
     } else {
-        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d%% %d,%d ", 
-            E.user, perc, E.cy + 1, E.cx + 1);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d%% %d,%d ", 
+            found, E.user, perc, E.cy + 1, E.cx + 1);
     }
 
+    int y = E.screenrows;
+    editorFrameClearLine(y, CELL_REVERSE);
     if(len > E.screencols) len = E.screencols;
-    abAppend(ab, status, len);
+    editorFramePut(y, 0, status, len, 0, CELL_REVERSE);
+    if(len + rlen <= E.screencols)
+        editorFramePut(y, E.screencols - rlen, rstatus, rlen, 0, CELL_REVERSE);
+}
 
-    while(len < E.screencols) {
-        if(E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
+void editorDrawMessageBar() {
+    int y = E.frame.rows - 1;
+    int cols = E.frame.cols;
+    editorFrameOrigin(0, 0, cols);
+    editorFrameClearLine(y, 0);
+    int msglen = strlen(E.statusmsg);
+    int width = cols;
+
+    /* the overlay takes the right end, messages keep what is left */
+    if(E.stats.overlay) {
+        char stats[128];
+        int len = editorStatsLine(stats, sizeof(stats));
+        if(len >= (int)sizeof(stats)) len = sizeof(stats) - 1;
+        if(len > cols) len = cols;
+        editorFramePut(y, cols - len, stats, len, 0, 0);
+        width = cols - len - 1;
+        if(width < 0) width = 0;
+    }
+
+    if(msglen > width) msglen = width;
+    if(msglen && time(NULL) - E.statusmsg_time < THOR_MSG_TIMEOUT) {
+        int padding = E.stats.overlay ? 0 : (width - msglen) / 2;
+        editorFramePut(y, padding, E.statusmsg, msglen, 0, 0);
+    }
+}
+
+int editorCellEqual(screenCell *a, screenCell *b) {
+    return a->ch == b->ch && a->fg == b->fg && a->bg == b->bg && a->attr == b->attr;
+}
+
+int editorCellBlank(screenCell *c) {
+    return c->ch == ' ' && c->fg == 0 && c->bg == 0 && c->attr == 0;
+}
+
+void editorEmitStyle(struct abuf *ab, screenCell *c) {
+    /* cells drawn by the highlighter have their escape ready made */
+    for(unsigned int h = 0; c->attr == 0 && h < SYNTAX_STYLES; h++) {
+        if(syntaxStyles[h].fg == c->fg && syntaxStyles[h].bg == c->bg) {
+            abAppend(ab, syntaxStyles[h].sgr, syntaxStyles[h].len);
+            return;
         }
     }
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[0%s", c->attr & CELL_REVERSE ? ";7" : "");
+    if(c->fg) len += snprintf(buf + len, sizeof(buf) - len, ";%d", c->fg);
+    if(c->bg) len += snprintf(buf + len, sizeof(buf) - len, ";%d", c->bg);
+    buf[len++] = 'm';
+    abAppend(ab, buf, len);
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[K", 3);
-    int msglen = strlen(E.statusmsg);
-    if(msglen > E.screencols) msglen = E.screencols;
-    if(msglen && time(NULL) - E.statusmsg_time < 5) {
-        int padding = (E.screencols - msglen) / 2;
-        while(padding--) abAppend(ab, " ", 1);
-        abAppend(ab, E.statusmsg, msglen);
+/* when the view moved by a few lines, let the terminal scroll the text area
+ * itself and shift the shadow to match, so only the new lines get sent */
+void editorFlushScroll(struct abuf *ab) {
+    struct editorFrame *f = &E.frame;
+    editorWindow *w = editorWindowCur();
+    int d = E.rowoff - f->rowoff;
+    int n = E.screenrows;
+    /* a scroll region spans whole lines, so only a full width window */
+    if(E.wrap || d == 0 || abs(d) >= n / 2 || f->win != w || w->cols != f->cols) return;
+
+    char buf[48];
+    int len = snprintf(buf, sizeof(buf), "\x1b[m\x1b[%d;%dr\x1b[%d%c\x1b[r",
+            w->top + 1, w->top + n, abs(d), d > 0 ? 'S' : 'T');
+    abAppend(ab, buf, len);
+
+    int cols = f->cols;
+    screenCell *shadow = &f->shadow[w->top * cols];
+    if(d > 0) {
+        memmove(shadow, &shadow[d * cols], sizeof(screenCell) * (n - d) * cols);
+    } else {
+        memmove(&shadow[-d * cols], shadow, sizeof(screenCell) * (n + d) * cols);
+    }
+    int from = w->top + (d > 0 ? n - d : 0);
+    for(int j = from * cols; j < (from + abs(d)) * cols; j++) {
+        f->shadow[j].ch = ' ';
+        f->shadow[j].fg = f->shadow[j].bg = f->shadow[j].attr = 0;
     }
 }
 
-void editorRefreshScreen() {
-    if(getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-    E.screenrows -= 2;
+#define FRAME_GAP 8
+
+void editorFlushFrame(struct abuf *ab) {
+    struct editorFrame *f = &E.frame;
+    int cols = f->cols;
 
+    if(!f->valid) {
+        abAppend(ab, "\x1b[m\x1b[2J", 7);
+        for(int j = 0; j < f->rows * cols; j++) {
+            f->shadow[j].ch = ' ';
+            f->shadow[j].fg = f->shadow[j].bg = f->shadow[j].attr = 0;
+        }
+    } else {
+        editorFlushScroll(ab);
+    }
+
+    if(!f->valid || f->mode != E.mode) {
+        if(E.mode != INSERT)
+            abAppend(ab, "\x1b[1 q", 5);    
+        else 
+            abAppend(ab, "\x1b[5 q", 5);
+    }
+
+    screenCell style = {' ', 0, 0, 0};
+    int styled = 0;
+    for(int y = 0; y < f->rows; y++) {
+        screenCell *line = &f->cells[y * cols];
+        screenCell *old = &f->shadow[y * cols];
+
+        int end = cols;
+        while(end > 0 && editorCellBlank(&line[end - 1])) end--;
+
+        int x = 0;
+        while(x < cols) {
+            while(x < cols && editorCellEqual(&line[x], &old[x])) x++;
+            if(x == cols) break;
+
+            int stop = x + 1;
+            for(int same = 0; stop < cols && same < FRAME_GAP; stop++) {
+                if(editorCellEqual(&line[stop], &old[stop])) same++;
+                else same = 0;
+            }
+            while(stop > x + 1 && editorCellEqual(&line[stop - 1], &old[stop - 1])) stop--;
+
+            char buf[32];
+            int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+            abAppend(ab, buf, len);
+
+            if(stop >= end && end < cols) {
+                stop = end;
+            }
+            while(x < stop) {
+                if(!styled || line[x].fg != style.fg || line[x].bg != style.bg ||
+                        line[x].attr != style.attr) {
+                    editorEmitStyle(ab, &line[x]);
+                    style = line[x];
+                    styled = 1;
+                }
+                int run = x + 1;
+                while(run < stop && line[run].fg == style.fg &&
+                        line[run].bg == style.bg && line[run].attr == style.attr)
+                    run++;
+                char *p = abReserve(ab, run - x);
+                if(p == NULL) die("realloc");
+                for(; x < run; x++) *p++ = line[x].ch;
+            }
+            if(stop == end && end < cols) {
+                if(style.fg || style.bg || style.attr) {
+                    abAppend(ab, "\x1b[m", 3);
+                    style.fg = style.bg = style.attr = 0;
+                }
+                abAppend(ab, "\x1b[K", 3);
+                x = cols;
+            }
+        }
+    }
+    if(styled) abAppend(ab, "\x1b[m", 3);
+
+    memcpy(f->shadow, f->cells, sizeof(screenCell) * f->rows * cols);
+    f->valid = 1;
+    f->rowoff = E.rowoff;
+    f->win = editorWindowCur();
+    f->mode = E.mode;
+}
+
+/* each window draws into its own rectangle of the frame.  the active one
+ * is drawn every time; another window is only drawn again when what it
+ * shows changed, otherwise it keeps its cells from the last frame.  to draw
+ * a window on another buffer that buffer is loaded into E for the moment */
+
+void editorDrawWindow(editorWindow *w, int force, int searched) {
+    if(w->top + w->rows >= E.frame.rows || w->left + w->cols > E.frame.cols) return;
+    if(E.cy > E.numrows) E.cy = E.numrows;
+    if(E.cy < E.numrows) {
+        erow *row = editorRowAt(E.cy);
+        if(E.cx > row->size) E.cx = row->size;
+    }
     editorScroll();
+    editorFrameOrigin(w->top, w->left, w->cols);
+
+    windowStamp st;
+    memset(&st, 0, sizeof(st));
+    st.layout = E.wins.layout;
+    st.buf = E.bufs.cur;
+    st.edits = E.edits;
+    st.numrows = E.numrows;
+    st.hl_gen = E.hl_gen;
+    st.rowoff = E.rowoff;
+    st.coloff = E.coloff;
+    st.wrapoff = E.wrapoff;
+    st.wrap = E.wrap;
+    st.hl_line = searched ? E.search.hl_line : -1;
+    st.hl_rx = searched ? E.search.hl_rx : 0;
+    st.hl_len = searched ? E.search.hl_len : 0;
+    st.marks = searched ? E.search.gen : 0;
+
+    if(force || memcmp(&st, &w->stamp, sizeof(st)) != 0) {
+        int hl_line = E.search.hl_line;
+        E.search.hl_line = st.hl_line;
+        E.search.draw = searched;
+        editorDrawRows();
+        E.search.hl_line = hl_line;
+        w->stamp = st;
+    }
+    editorDrawStatusBar();
+}
 
-    struct abuf ab = ABUF_INIT;
+void editorDrawSeparators(layoutNode *n) {
+    if(n->win) return;
+    int x = n->left + (n->width - 1) / 2;
+    if(n->vertical && x >= 0 && x < E.frame.cols) {
+        for(int y = n->top; y < n->top + n->height && y < E.frame.rows - 1; y++) {
+            screenCell *c = &E.frame.cells[y * E.frame.cols + x];
+            c->ch = '|';
+            c->fg = c->bg = 0;
+            c->attr = CELL_REVERSE;
+        }
+    }
+    editorDrawSeparators(n->kid[0]);
+    editorDrawSeparators(n->kid[1]);
+}
 
-    abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
+void editorDrawWindows() {
+    struct editorWindows *ws = &E.wins;
+    editorWindow *home = editorWindowCur();
+    int hb = E.bufs.cur;
+
+    editorWindowPark(home);
+    for(int k = 0; k < ws->n; k++) {
+        editorWindow *w = ws->list[k];
+        if(w == home) continue;
+        if(w->buf != E.bufs.cur) {
+            editorBufferPark(&E.bufs.list[E.bufs.cur]);
+            editorBufferLoad(&E.bufs.list[w->buf]);
+            E.bufs.cur = w->buf;
+            editorIndexerIngest();
+            editorDecodeIngest();
+        }
+        editorWindowLoad(w);
+        editorFollowIngest(w);
+        editorDrawWindow(w, 0, w->buf == hb);
+        editorWindowPark(w);
+    }
+    if(E.bufs.cur != hb) {
+        editorBufferPark(&E.bufs.list[E.bufs.cur]);
+        editorBufferLoad(&E.bufs.list[hb]);
+        E.bufs.cur = hb;
+    }
+    editorWindowLoad(home);
+    editorDrawWindow(home, 1, 1);
+    editorWindowPark(home);
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+    editorFrameOrigin(0, 0, E.frame.cols);
+    editorDrawSeparators(ws->root);
+}
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, 
-            (E.rx - E.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+void editorRefreshScreen() {
+    editorIndexerIngest();
+    editorDecodeIngest();
+    editorFollowIngest(editorWindowCur());
+    editorScroll();
 
-    abAppend(&ab, "\x1b[?25h", 6);
+    long long t = benchStart();
+    long long st = editorStatsStart();
+    editorDrawWindows();
+    editorDrawMessageBar();
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    struct abuf *ab = &E.out;
+    abReset(ab);
+
+    abAppend(ab, "\x1b[?25l", 6);
+    editorFlushFrame(ab);
+
+    char buf[32];
+    editorWindow *w = editorWindowCur();
+    if(E.wrap)
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", w->top + E.wrapy + 1,
+                w->left + E.wrapx + 1);
+    else
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", w->top + (E.cy - E.rowoff) + 1, 
+                w->left + (E.rx - E.coloff) + 1);
+    abAppend(ab, buf, strlen(buf));
+
+    abAppend(ab, "\x1b[?25h", 6);
+    benchRecord(BENCH_DRAW, t);
+    editorStatsFrame(st, ab->len);
+
+    if(!E.bench.on) write(STDOUT_FILENO, ab->b, ab->len);
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -1114,10 +7000,24 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
     while(1) {
         editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
+        if(!editorInputPending()) editorRefreshScreen();
 
         int c = editorReadKey();
-        if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+        if(c == PASTE_START) {
+            int len;
+            char *text = editorReadPaste(&len);
+            for(int j = 0; j < len; j++) {
+                if(iscntrl(text[j]) || (unsigned char)text[j] >= 128) continue;
+                if(buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                    if(buf == NULL) die("realloc");
+                }
+                buf[buflen++] = text[j];
+            }
+            buf[buflen] = '\0';
+            free(text);
+        } else if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
             if(buflen != 0) buf[--buflen] = '\0';
         } else if(c == '\x1b') {
             editorSetStatusMessage("");
@@ -1148,7 +7048,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 }
 
 void editorMoveCursor(int key) {
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow *row = editorRowAt(E.cy);
 
     switch(key) {
         case ARROW_LEFT:
@@ -1156,7 +7056,7 @@ void editorMoveCursor(int key) {
                 E.cx--;
             } else if(E.cy > 0) {
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
         case ARROW_RIGHT:
@@ -1179,13 +7079,101 @@ void editorMoveCursor(int key) {
             break;
     }
 
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = editorRowAt(E.cy);
     int rowlen = row ? row->size : 0;
     if(E.cx > rowlen) {
         E.cx = rowlen;
     }
 }
 
+/* puts the cursor straight on a line and column, clamped to the text;
+ * finding the row is a walk down the rope, however far away it is */
+void editorCursorTo(int line, int col) {
+    if(line > E.numrows) line = E.numrows;
+    if(line < 0) line = 0;
+    erow *row = editorRowAt(line);
+    int rowlen = row ? row->size : 0;
+    if(col > rowlen) col = rowlen;
+    if(col < 0) col = 0;
+    E.cy = line;
+    E.cx = col;
+    editorScroll();
+}
+
+/* lands the cursor on line for a jump: when it's off screen the view is
+ * centered on it.  lines the indexer hasn't got to yet are waited for */
+void editorJumpTo(int line, int col) {
+    editorIndexerReach(line);
+    editorDecodeReach(line);
+    if(line >= E.numrows) line = E.numrows ? E.numrows - 1 : 0;
+    if(line < E.rowoff || line >= E.rowoff + E.screenrows) {
+        E.rowoff = line - E.screenrows / 2;
+        if(E.rowoff < 0) E.rowoff = 0;
+        E.wrapoff = 0;
+    }
+    editorCursorTo(line, col);
+}
+
+/* blanks, punctuation and word characters, as w and b see them */
+int editorCharKind(char c) {
+    if(isspace((unsigned char)c)) return 0;
+    return is_separator(c) ? 1 : 2;
+}
+
+void editorWordMove(int dir) {
+    int cy = E.cy, x = E.cx;
+    erow *row = editorRowAt(cy);
+    if(dir > 0) {
+        if(row == NULL) return;
+        if(x < row->size && editorCharKind(row->chars[x])) {
+            int kind = editorCharKind(row->chars[x]);
+            while(x < row->size && editorCharKind(row->chars[x]) == kind) x++;
+        }
+        while(1) {
+            while(x < row->size && editorCharKind(row->chars[x]) == 0) x++;
+            if(x < row->size || cy + 1 >= E.numrows) break;
+            row = editorRowAt(++cy);
+            x = 0;
+            if(row->size == 0) break;
+        }
+    } else {
+        if(row == NULL) {
+            if(cy == 0) return;
+            row = editorRowAt(--cy);
+            x = row->size;
+        }
+        while(1) {
+            x--;
+            while(x >= 0 && editorCharKind(row->chars[x]) == 0) x--;
+            if(x >= 0) {
+                int kind = editorCharKind(row->chars[x]);
+                while(x > 0 && editorCharKind(row->chars[x - 1]) == kind) x--;
+                break;
+            }
+            if(cy == 0) {
+                x = 0;
+                break;
+            }
+            row = editorRowAt(--cy);
+            x = row->size;
+            if(x == 0) break;
+        }
+    }
+    editorCursorTo(cy, x);
+}
+
+/* } and { go to the next or previous blank line past the paragraph the
+ * cursor is in, or to the very end or start when there is none */
+void editorParagraphMove(int dir) {
+    if(E.numrows == 0) return;
+    int cy = E.cy < E.numrows ? E.cy : E.numrows - 1;
+    int from = editorFindLine(cy, dir, 0);
+    int to = from < 0 ? -1 : editorFindLine(from, dir, 1);
+    if(to >= 0) editorJumpTo(to, 0);
+    else if(dir > 0) editorJumpTo(E.numrows - 1, INT_MAX);
+    else editorJumpTo(0, 0);
+}
+
 void editorScrollKey(int key) {
     switch(key) {
         case SCROLL_DOWN:
@@ -1193,6 +7181,7 @@ void editorScrollKey(int key) {
              
             if(E.cy == E.rowoff) E.cy++;
             E.rowoff++;
+            E.wrapoff = 0;
 
             break;
         case SCROLL_UP:
@@ -1200,6 +7189,7 @@ void editorScrollKey(int key) {
                 
             if(E.cy == E.rowoff + E.screenrows - 2) E.cy--;
             E.rowoff--;
+            E.wrapoff = 0;
             
             break;
     }
@@ -1221,44 +7211,91 @@ void editorCommand() {
                 }
             }
             if(is_number == 1) {
-                int line = atoi(command);
-
-                editorSetStatusMessage("/tp %s %d 0 0", E.user, line);
-                if(line < E.numrows) { 
-                    if(line > E.cy) {
-                        while(E.cy != line - 1) {
-                            editorMoveCursor(ARROW_DOWN);
-        E.rowoff = E.rowoff + E.screenrows + 1;
-                        }
-                    } else if(line < E.cy) {
-                        while(E.cy != line - 1) {
-                            editorMoveCursor(ARROW_UP);
-                        }
-                    }
-                }
+                long line = strtol(command, NULL, 10);
+                if(line > INT_MAX) line = INT_MAX;
+
+                editorSetStatusMessage("/tp %s %ld 0 0", E.user, line);
+                editorJumpTo(line > 0 ? line - 1 : 0, E.cx);
             }
 
+        } else if(command[0] == 'e' && (command[1] == ' ' || command[1] == '\0')) {
+            char *name = command + 1;
+            while(*name == ' ') name++;
+            if(*name) editorBufferEdit(name);
+            else editorSetStatusMessage("Edit what? :e needs a file name");
+        } else if(strcmp(command, "bn") == 0) {
+            editorBufferCycle(1);
+        } else if(strcmp(command, "bp") == 0) {
+            editorBufferCycle(-1);
+        } else if(strcmp(command, "ls") == 0) {
+            editorBufferList();
+        } else if((command[0] == 's' && command[1] == 'p') || (command[0] == 'v' && command[1] == 's')) {
+            if(command[2] != ' ' && command[2] != '\0') {
+                editorSetStatusMessage("What the heck is \":%s\"? Type :help in need of idk, help", command);
+            } else {
+                char *name = command + 2;
+                while(*name == ' ') name++;
+                editorWindowSplit(command[0] == 'v');
+                if(*name) editorBufferEdit(name);
+            }
+        } else if(strncmp(command, "follow", 6) == 0 && (command[6] == ' ' || command[6] == '\0')) {
+            editorFollowCommand(command + 6);
+        } else if(strcmp(command, "close") == 0) {
+            editorWindowClose();
+        } else if(strcmp(command, "only") == 0) {
+            editorWindowOnly();
+        } else if(strcmp(command, "stats") == 0) {
+            E.stats.overlay = !E.stats.overlay;
+            editorSetStatusMessage(E.stats.overlay ? "Counting everything" : "Stopped staring at the counters");
+        } else if(strncmp(command, "autosave", 8) == 0 && (command[8] == ' ' || command[8] == '\0')) {
+            char *arg = command + 8;
+            while(*arg == ' ') arg++;
+            if(*arg) editorAutosaveSet(atoi(arg) > 0 ? atoi(arg) : 0);
+            else editorAutosaveSet(E.autosave ? 0 : THOR_AUTOSAVE);
+        } else if(strcmp(command, "wrap") == 0) {
+            E.wrap = !E.wrap;
+            E.wrapoff = 0;
+            editorSetStatusMessage(E.wrap ? "Lines now bend to your will" : "Lines run free again");
         } else if(command[0] == 'w' && command[1] == 'q') { 
             editorSave();
+            editorSaveWait();
+            int other = editorBufferDirty();
+            if(E.dirty) {
+                /* the save didn't make it, its message says why */
+            } else if(other >= 0) {
+                editorSetStatusMessage("Buffer %d has unsaved changes too (:bn to get there)", other + 1);
+            } else {
+                editorBufferCloseAll();
 
-            write(STDOUT_FILENO, "\x1b[2J", 4);
-            write(STDOUT_FILENO, "\x1b[H", 3);
+                write(STDOUT_FILENO, "\x1b[2J", 4);
+                write(STDOUT_FILENO, "\x1b[H", 3);
 
-            exit(0); 
+                exit(0); 
+            }
         } else if(command[0] == 'w') {
             editorSave();
         } else if(command[0] == 'q') {
             if(E.dirty && command[1] != '!') {
                 editorSetStatusMessage("Unsaved Changes Detected (use ! to override)");
+            } else if(command[1] != '!' && editorBufferDirty() >= 0) {
+                editorSetStatusMessage("Buffer %d has unsaved changes (use ! to override)", editorBufferDirty() + 1);
             } else {
+                editorBufferCloseAll();
                 write(STDOUT_FILENO, "\x1b[2J", 4);
                 write(STDOUT_FILENO, "\x1b[H", 3);
 
                 exit(0);
             } 
-        } else if(strcmp(command, "help") == 0) editorSetStatusMessage(":help quit | :help editor | :help other");
+        } else if((command[0] == 'g' || command[0] == 'v') && command[1] == '/') {
+            editorGlobal(command);
+        } else if((command[0] == 's' || (command[0] == '%' && command[1] == 's')) &&
+                command[command[0] == '%' ? 2 : 1] == '/') {
+            editorSubstitute(command);
+        } else if(strcmp(command, "help") == 0) editorSetStatusMessage(":help quit | :help editor | :help buffers | :help windows | :help other");
         else if(strcmp(command, "help quit") == 0) editorSetStatusMessage(":q = quit | :q! = override quit | :w = save | :wq = save and quit");
-        else if(strcmp(command, "help editor") == 0) editorSetStatusMessage(":num = goto line num | / = search");
+        else if(strcmp(command, "help buffers") == 0) editorSetStatusMessage(":e file = edit file | :bn = next buffer | :bp = previous buffer | :ls = list buffers | :follow [N] = tail the file");
+        else if(strcmp(command, "help windows") == 0) editorSetStatusMessage(":sp [file] = split | :vs [file] = split sideways | ^W = next window | :close | :only");
+        else if(strcmp(command, "help editor") == 0) editorSetStatusMessage(":num = goto line num | / = search | u = undo | ^R = redo | :g/pat/d = delete matching lines | :%s/pat/rep/g = replace | :wrap = soft wrap | :autosave [secs] = swap file | :stats = render counters");
         else if(strcmp(command, "help other") == 0) editorSetStatusMessage(":help = shows help | :creds = shows credits");
         else if(strcmp(command, "creds") == 0) editorSetStatusMessage("Made by OrangeXarot, Named by i._.tram");
         else {
@@ -1329,6 +7366,24 @@ void editorChangeMode(int mode) {
 
 void editorProcessKeypress() {    
     int c = editorReadKey();
+    /* a whole stay in insert mode is one step, unless the cursor is moved
+     * or the typing stops for a while */
+    time_t now = time(NULL);
+    if(E.mode != INSERT || now - E.undo.typed >= THOR_UNDO_PAUSE) editorUndoBegin();
+    E.undo.typed = now;
+
+    /* pasted text is only ever text: outside insert mode it would have
+     * to be taken as commands, so it is read and let go */
+    if(c == PASTE_START) {
+        if(E.mode == INSERT) {
+            editorPaste();
+        } else {
+            int len;
+            free(editorReadPaste(&len));
+            editorSetStatusMessage("Pasting is for insert mode, press i first");
+        }
+        return;
+    }
 
     if(E.mode == INSERT) {
         editorSetStatusMessage("-- INSERT MODE --");
@@ -1338,12 +7393,14 @@ void editorProcessKeypress() {
                 break;
 
             case HOME_KEY:
+                editorUndoBegin();
                 E.cx = 0;
                 break;
 
             case END_KEY:
+                editorUndoBegin();
                 if(E.cy < E.numrows)
-                    E.cx = E.row[E.cy].size;
+                    E.cx = editorRowAt(E.cy)->size;
                 break;
 
             case BACKSPACE:
@@ -1354,23 +7411,15 @@ void editorProcessKeypress() {
 
             case PAGE_UP:
             case PAGE_DOWN: 
-                {
-                    if(c == PAGE_UP) {
-                        E.cy = E.rowoff;
-                    } else if(c == PAGE_DOWN) {
-                        E.cy = E.rowoff + E.screenrows - 1;
-                        if(E.cy > E.numrows) E.cy = E.numrows;
-                    }
-
-                    int times = E.screenrows;
-                    while(times--) 
-                        editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-                }
+                editorUndoBegin();
+                if(c == PAGE_UP) editorCursorTo(E.rowoff - E.screenrows, E.cx);
+                else editorCursorTo(E.rowoff + 2 * E.screenrows - 1, E.cx);
                 break;
             case ARROW_LEFT:
             case ARROW_RIGHT:
             case ARROW_UP:
             case ARROW_DOWN:
+                editorUndoBegin();
                 editorMoveCursor(c);
                 break;
 
@@ -1445,30 +7494,30 @@ void editorProcessKeypress() {
 
             case PAGE_UP:
             case PAGE_DOWN: 
-                {
-                    if(c == PAGE_UP) {
-                        E.cy = E.rowoff;
-                    } else if(c == PAGE_DOWN) {
-                        E.cy = E.rowoff + E.screenrows - 1;
-                        if(E.cy > E.numrows) E.cy = E.numrows;
-                    }
-
-                    int times = E.screenrows;
-                    while(times--) 
-                        editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-                }
+                if(c == PAGE_UP) editorCursorTo(E.rowoff - E.screenrows, E.cx);
+                else editorCursorTo(E.rowoff + 2 * E.screenrows - 1, E.cx);
                 break;
 
             case 'g':
-                E.cy = 0;
+                editorCursorTo(0, E.cx);
                 editorSetStatusMessage("The Beginning of Time");
                 break;          
 
             case 'G':
-                E.cy = E.numrows;
+                editorCursorTo(E.numrows, E.cx);
                 editorSetStatusMessage("The End of Time");
                 break;
 
+            case 'w':
+            case 'b':
+                editorWordMove(c == 'w' ? 1 : -1);
+                break;
+
+            case '}':
+            case '{':
+                editorParagraphMove(c == '}' ? 1 : -1);
+                break;
+
             case ARROW_LEFT:
             case ARROW_RIGHT:
             case ARROW_UP:
@@ -1507,7 +7556,7 @@ void editorProcessKeypress() {
 
             case END_KEY:
                 if(E.cy < E.numrows)
-                    E.cx = E.row[E.cy].size;
+                    E.cx = editorRowAt(E.cy)->size;
                 break;
 
 
@@ -1545,44 +7594,363 @@ void editorProcessKeypress() {
             case 'p':
                 editorPasteRows();
                 break;
+
+            case 'u':
+                editorUndo();
+                break;
+
+            case CTRL_KEY('r'):
+                editorRedo();
+                break;
+
+            case CTRL_KEY('w'):
+                editorWindowFocus((E.wins.cur + 1) % E.wins.n);
+                break;
+        }
+    }
+}
+
+
+/*** BENCH ***/
+
+/* thor --bench file [trace] opens the file with no terminal, replays a
+ * keystroke trace through editorProcessKeypress, drawing a frame after
+ * every key, and prints how long the hot paths took.  a trace is text:
+ * every character is a key, newlines are skipped so it can be laid out
+ * on lines, and special keys go in brackets like <esc>, <cr>, <pgdn> or
+ * <C-r>, optionally repeated as <pgdn*20>; <lt> is a literal '<'.  saves
+ * go to file.bench, which is removed afterwards */
+
+const char *benchDefaultTrace =
+    "<pgdn*40><pgup*20>G<pgup*10>g\n"
+    "/int<right*5><cr>\n"
+    "ohello bench<esc>\n"
+    "<down*30>ithor was here<bs*5><esc>\n"
+    "u<C-r>\n"
+    ":w<cr>\n";
+
+struct benchKeyName {
+    const char *name;
+    int key;
+};
+
+struct benchKeyName benchKeyNames[] = {
+    {"esc", '\x1b'}, {"cr", '\r'}, {"tab", '\t'}, {"bs", BACKSPACE},
+    {"del", DEL_KEY}, {"up", ARROW_UP}, {"down", ARROW_DOWN},
+    {"left", ARROW_LEFT}, {"right", ARROW_RIGHT}, {"home", HOME_KEY},
+    {"end", END_KEY}, {"pgup", PAGE_UP}, {"pgdn", PAGE_DOWN}, {"lt", '<'},
+    {NULL, 0}
+};
+
+long long benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long benchStart() {
+    return E.bench.on ? benchNow() : 0;
+}
+
+void benchRecord(int op, long long start) {
+    if(!E.bench.on) return;
+    benchStat *st = &E.bench.stat[op];
+    if(st->n == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 256;
+        st->ns = realloc(st->ns, sizeof(long long) * st->cap);
+        if(st->ns == NULL) die("realloc");
+    }
+    st->ns[st->n++] = benchNow() - start;
+}
+
+void benchAddKey(int key, int times) {
+    struct editorBench *B = &E.bench;
+    B->keys = realloc(B->keys, sizeof(int) * (B->nkeys + times));
+    if(B->keys == NULL) die("realloc");
+    while(times--) B->keys[B->nkeys++] = key;
+}
+
+void benchParseTrace(const char *s, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] == '\n' || s[i] == '\r') continue;
+        if(s[i] != '<') {
+            benchAddKey((unsigned char)s[i], 1);
+            continue;
+        }
+
+        const char *end = memchr(&s[i], '>', len - i);
+        int n = end ? end - &s[i] - 1 : 0;
+        char name[32];
+        if(n <= 0 || n >= (int)sizeof(name)) {
+            fprintf(stderr, "thor: bad key at byte %zu of the trace\n", i);
+            exit(1);
+        }
+        memcpy(name, &s[i + 1], n);
+        name[n] = '\0';
+        i += n + 1;
+
+        int times = 1;
+        char *star = strchr(name, '*');
+        if(star) {
+            *star = '\0';
+            times = atoi(star + 1);
+        }
+        int key = -1;
+        if(name[0] == 'C' && name[1] == '-' && name[2] && !name[3])
+            key = CTRL_KEY(name[2]);
+        for(int k = 0; key == -1 && benchKeyNames[k].name; k++)
+            if(!strcmp(name, benchKeyNames[k].name)) key = benchKeyNames[k].key;
+        if(key == -1 || times < 1) {
+            fprintf(stderr, "thor: bad key <%s> in the trace\n", name);
+            exit(1);
+        }
+        benchAddKey(key, times);
+    }
+}
+
+void benchLoadTrace(const char *path) {
+    if(path == NULL) {
+        benchParseTrace(benchDefaultTrace, strlen(benchDefaultTrace));
+        return;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if(!fp) die("fopen");
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    while(!feof(fp)) {
+        if(len == cap) {
+            cap = cap ? cap * 2 : 4096;
+            buf = realloc(buf, cap);
+            if(buf == NULL) die("realloc");
+        }
+        len += fread(buf + len, 1, cap - len, fp);
+        if(ferror(fp)) die("fread");
+    }
+    fclose(fp);
+    benchParseTrace(buf, len);
+    free(buf);
+}
+
+/* the trace running out ends the run like :q would */
+int editorBenchKey() {
+    struct editorBench *B = &E.bench;
+    if(B->pos == B->nkeys) exit(0);
+    return B->keys[B->pos++];
+}
+
+int benchCompare(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+void editorBenchReport() {
+    static const char *names[BENCH_OPS] = {
+        "open", "syntax", "draw", "find", "save", "key"
+    };
+    struct editorBench *B = &E.bench;
+    editorSaveWait();
+    unlink(B->out);
+
+    printf("\r\nthor --bench %s: %d rows, %d keys, %dx%d\n", B->file,
+            E.numrows, B->pos, E.frame.cols, E.frame.rows);
+    printf("%-8s %8s %10s %10s %10s %10s   (us)\n",
+            "op", "count", "p50", "p90", "p99", "max");
+    for(int op = 0; op < BENCH_OPS; op++) {
+        benchStat *st = &B->stat[op];
+        if(st->n == 0) {
+            printf("%-8s %8d\n", names[op], 0);
+            continue;
         }
+        qsort(st->ns, st->n, sizeof(long long), benchCompare);
+        printf("%-8s %8d %10.1f %10.1f %10.1f %10.1f\n", names[op], st->n,
+                st->ns[(st->n - 1) / 2] / 1e3,
+                st->ns[(st->n - 1) * 9 / 10] / 1e3,
+                st->ns[(st->n - 1) * 99 / 100] / 1e3,
+                st->ns[st->n - 1] / 1e3);
     }
 }
 
+int editorBenchMain(int argc, char *argv[]) {
+    if(argc < 1) {
+        fprintf(stderr, "usage: thor --bench file [trace]\n");
+        return 1;
+    }
+
+    struct editorBench *B = &E.bench;
+    B->on = 1;
+    B->file = argv[0];
+    B->out = malloc(strlen(argv[0]) + 7);
+    sprintf(B->out, "%s.bench", argv[0]);
+    benchLoadTrace(argc > 1 ? argv[1] : NULL);
+
+    initEditor();
+    atexit(editorBenchReport);
+
+    long long t = benchNow();
+    editorOpen(B->file);
+    benchRecord(BENCH_OPEN, t);
+
+    editorRefreshScreen();
+    while(1) {
+        t = benchNow();
+        editorProcessKeypress();
+        benchRecord(BENCH_KEY, t);
+        editorRefreshScreen();
+    }
+    return 0;
+}
+
+/*** STATS ***/
+
+/* always-on counters are plain increments; the clock is only read once
+ * someone is looking, through :stats or THOR_STATS=<file> */
+
+int editorStatsOn() {
+    return E.stats.overlay || E.stats.dump != NULL;
+}
+
+long long editorStatsStart() {
+    return editorStatsOn() ? benchNow() : 0;
+}
+
+void statClose(statGauge *g) {
+    g->last = g->cur;
+    if(g->cur > g->max) g->max = g->cur;
+    g->total += g->cur;
+    g->cur = 0;
+}
+
+void editorStatsFrame(long long start, int bytes) {
+    struct editorStats *st = &E.stats;
+    st->frames++;
+    if(start) st->g[STAT_FRAME_NS].cur = benchNow() - start;
+    st->g[STAT_BYTES].cur = bytes;
+    statClose(&st->g[STAT_FRAME_NS]);
+    statClose(&st->g[STAT_BYTES]);
+    statClose(&st->g[STAT_APPENDS]);
+}
+
+/* everything relexed between two keys is charged to the first of them */
+void editorStatsKey() {
+    struct editorStats *st = &E.stats;
+    st->keys++;
+    st->chain = 0;
+    statClose(&st->g[STAT_HL_ROWS]);
+    statClose(&st->g[STAT_CASCADE]);
+}
+
+/* a cascade is a run of consecutive rows whose multiline comment state
+ * flipped, each one dragging the next row back in for a rescan */
+void editorStatsChain(int flipped) {
+    struct editorStats *st = &E.stats;
+    st->chain = flipped ? st->chain + 1 : 0;
+    if(st->chain > st->g[STAT_CASCADE].cur) st->g[STAT_CASCADE].cur = st->chain;
+}
+
+int editorStatsLine(char *buf, int size) {
+    statGauge *g = E.stats.g;
+    return snprintf(buf, size, "frame %.2fms (max %.2f) | %lldB | %lld appends | "
+            "hl %lld rows | cascade %lld",
+            g[STAT_FRAME_NS].last / 1e6, g[STAT_FRAME_NS].max / 1e6,
+            g[STAT_BYTES].last, g[STAT_APPENDS].last,
+            g[STAT_HL_ROWS].last, g[STAT_CASCADE].last);
+}
+
+void editorStatsDumpGauge(FILE *fp, const char *name, statGauge *g,
+        long long n, int last) {
+    fprintf(fp, "  \"%s\": {\"last\": %lld, \"max\": %lld, \"total\": %lld, "
+            "\"mean\": %.2f}%s\n", name, g->last, g->max, g->total,
+            n ? (double)g->total / n : 0.0, last ? "" : ",");
+}
+
+void editorStatsDump() {
+    struct editorStats *st = &E.stats;
+    FILE *fp = fopen(st->dump, "w");
+    if(fp == NULL) return;
+
+    /* fold in whatever the last key did before the editor went away */
+    statClose(&st->g[STAT_HL_ROWS]);
+    statClose(&st->g[STAT_CASCADE]);
+
+    fprintf(fp, "{\n  \"frames\": %lld,\n  \"keys\": %lld,\n", st->frames, st->keys);
+    editorStatsDumpGauge(fp, "frame_ns", &st->g[STAT_FRAME_NS], st->frames, 0);
+    editorStatsDumpGauge(fp, "bytes", &st->g[STAT_BYTES], st->frames, 0);
+    editorStatsDumpGauge(fp, "appends", &st->g[STAT_APPENDS], st->frames, 0);
+    editorStatsDumpGauge(fp, "hl_rows", &st->g[STAT_HL_ROWS], st->keys, 0);
+    editorStatsDumpGauge(fp, "cascade", &st->g[STAT_CASCADE], st->keys, 1);
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+void editorStatsInit() {
+    char *path = getenv("THOR_STATS");
+    E.stats.dump = NULL;
+    E.stats.overlay = 0;
+    if(path && path[0]) {
+        E.stats.dump = path;
+        atexit(editorStatsDump);
+    }
+}
 
 /*** INIT ***/
 
 void initEditor() {
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.cprow = NULL;
-    E.dirty = 0;
+    E.autosave = THOR_AUTOSAVE;
+    E.wrap = 0;
+    editorStatsInit();
+    editorSlabInit();
+    editorBufferBlank();
+    E.bufs.n = 0;
+    E.bufs.cur = 0;
+    editorBufferAdd();
+    editorWindowsInit();
+    E.yank.pieces = NULL;
+    E.yank.n = 0;
+    E.yank.cap = 0;
+    E.yank.lines = 0;
     E.mode = COMMAND;
-    E.filename = NULL;
     E.user = getlogin();
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.syntax = NULL;
-
-    if(getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-    E.screenrows -= 2;
+    E.inotify = -1;
+    E.search.job = -1;
+    E.search.hl_line = -1;
+    pthread_mutex_init(&E.search.pool.lock, NULL);
+    pthread_cond_init(&E.search.pool.work, NULL);
+    pthread_cond_init(&E.search.pool.posted, NULL);
+
+    if(pipe(E.wakefd) == -1) die("pipe");
+    fcntl(E.wakefd[0], F_SETFL, O_NONBLOCK);
+    fcntl(E.wakefd[1], F_SETFL, O_NONBLOCK);
+    E.winch = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleWinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+    /* a compressor that dies mid save must not take thor with it */
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    editorUpdateWindowSize();
 }
 
 int main(int argc, char *argv[]) {
+    if(argc >= 2 && strcmp(argv[1], "--bench") == 0)
+        return editorBenchMain(argc - 2, argv + 2);
+
     enableRawMode();
     initEditor();
     if(argc >= 2) {
         editorOpen(argv[1]);
     }
 
+    editorRefreshScreen();
     while(1) {
-        editorRefreshScreen();
         editorProcessKeypress();
+        if(!editorInputPending()) editorRefreshScreen();
     }
     return 0;
 }